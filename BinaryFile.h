@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A simple versioned, checksummed container of named binary sections, laid
+// out so that it can be memory-mapped and read in place:
+//
+//   Header | section table | sections, each starting on a 64-byte boundary
+//
+// The checksum covers everything after the header.
+namespace BinaryFile {
+
+constexpr std::size_t kAlignment = 64;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t nSections;
+  uint64_t fileSize;
+  uint64_t checksum;
+};
+
+struct SectionEntry {
+  char name[48];
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+// FNV-1a over 64-bit words (and the trailing bytes), fast enough to verify
+// large files at load time.
+inline uint64_t checksum(const char *data, std::size_t size)
+{
+  uint64_t h = 14695981039346656037ull;
+  std::size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    h = (h ^ word) * 1099511628211ull;
+  }
+  for (; i < size; ++i) h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+  return h;
+}
+
+inline std::size_t alignUp(std::size_t n) { return (n + kAlignment - 1) / kAlignment * kAlignment; }
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open " + path);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Cannot stat " + path);
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+
+    if (size_ > 0) {
+      void *p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("Cannot mmap " + path);
+      }
+      data_ = static_cast<const char *>(p);
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile()
+  {
+    if (data_) ::munmap(const_cast<char *>(data_), size_);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+private:
+  const char *data_{nullptr};
+  std::size_t size_{0};
+};
+
+class Writer {
+public:
+  Writer(const char *magic, uint32_t version) : version_(version) { std::memcpy(magic_, magic, std::min<std::size_t>(std::strlen(magic), 8)); }
+
+  void add(const std::string &name, const void *data, std::size_t bytes)
+  {
+    if (name.size() >= sizeof(SectionEntry::name)) throw std::runtime_error("Section name too long: " + name);
+    sections_.push_back({name, std::string(static_cast<const char *>(data), bytes)});
+  }
+
+  template <typename T>
+  void add(const std::string &name, const std::vector<T> &v)
+  {
+    add(name, v.data(), v.size() * sizeof(T));
+  }
+
+  void write(const std::string &path) const
+  {
+    std::size_t offset = alignUp(sizeof(Header) + sections_.size() * sizeof(SectionEntry));
+    std::vector<SectionEntry> table(sections_.size());
+    for (size_t i = 0; i < sections_.size(); ++i) {
+      std::memset(&table[i], 0, sizeof(SectionEntry));
+      std::strncpy(table[i].name, sections_[i].first.c_str(), sizeof(SectionEntry::name) - 1);
+      table[i].offset = offset;
+      table[i].bytes = sections_[i].second.size();
+      offset = alignUp(offset + table[i].bytes);
+    }
+
+    std::vector<char> buffer(offset, 0);
+    std::memcpy(buffer.data() + sizeof(Header), table.data(), table.size() * sizeof(SectionEntry));
+    for (size_t i = 0; i < sections_.size(); ++i) {
+      std::memcpy(buffer.data() + table[i].offset, sections_[i].second.data(), table[i].bytes);
+    }
+
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.magic, magic_, 8);
+    header.version = version_;
+    header.nSections = static_cast<uint32_t>(sections_.size());
+    header.fileSize = buffer.size();
+    header.checksum = checksum(buffer.data() + sizeof(Header), buffer.size() - sizeof(Header));
+    std::memcpy(buffer.data(), &header, sizeof(Header));
+
+    // write to a temporary file and rename, so readers never see a partial file
+    const std::string tmp = path + ".tmp";
+    {
+      std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+      out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+      if (!out) throw std::runtime_error("Cannot write " + tmp);
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) throw std::runtime_error("Cannot rename " + tmp);
+  }
+
+private:
+  char magic_[8]{};
+  uint32_t version_;
+  std::vector<std::pair<std::string, std::string>> sections_;
+};
+
+// Maps a file written by Writer and hands out pointers straight into the
+// mapping. Keep the Reader (or the shared MappedFile) alive while using them.
+class Reader {
+public:
+  Reader(const std::string &path, const char *magic, uint32_t version, bool verifyChecksum = true)
+    : file_(std::make_shared<MappedFile>(path))
+  {
+    if (file_->size() < sizeof(Header)) throw std::runtime_error(path + " is too small");
+    std::memcpy(&header_, file_->data(), sizeof(Header));
+    if (std::memcmp(header_.magic, magic, 8) != 0) throw std::runtime_error(path + " has the wrong format");
+    if (header_.version != version) {
+      throw std::runtime_error(path + " has version " + std::to_string(header_.version) + ", expected " +
+                               std::to_string(version));
+    }
+    if (header_.fileSize != file_->size()) throw std::runtime_error(path + " is truncated");
+    if (verifyChecksum &&
+        checksum(file_->data() + sizeof(Header), file_->size() - sizeof(Header)) != header_.checksum) {
+      throw std::runtime_error(path + " is corrupted (checksum mismatch)");
+    }
+
+    table_ = reinterpret_cast<const SectionEntry *>(file_->data() + sizeof(Header));
+  }
+
+  bool has(const std::string &name) const { return find(name) != nullptr; }
+
+  template <typename T>
+  const T *section(const std::string &name, std::size_t &count) const
+  {
+    const SectionEntry *entry = find(name);
+    if (!entry) throw std::runtime_error("Missing section " + name);
+    if (entry->bytes % sizeof(T) != 0 || entry->offset + entry->bytes > file_->size()) {
+      throw std::runtime_error("Malformed section " + name);
+    }
+    count = entry->bytes / sizeof(T);
+    return reinterpret_cast<const T *>(file_->data() + entry->offset);
+  }
+
+  template <typename T>
+  const T &scalar(const std::string &name) const
+  {
+    std::size_t count;
+    const T *p = section<T>(name, count);
+    if (count != 1) throw std::runtime_error("Malformed section " + name);
+    return *p;
+  }
+
+  const std::shared_ptr<MappedFile> &file() const { return file_; }
+
+private:
+  const SectionEntry *find(const std::string &name) const
+  {
+    for (uint32_t i = 0; i < header_.nSections; ++i) {
+      if (name == table_[i].name) return &table_[i];
+    }
+    return nullptr;
+  }
+
+  std::shared_ptr<MappedFile> file_;
+  Header header_;
+  const SectionEntry *table_{nullptr};
+};
+
+} // namespace BinaryFile
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+// Streams a fixed sequence of chunks through two buffers, for data that does
+// not fit in memory at once.
+//
+// forEach(process) calls process(chunk, buffer) for every chunk in order.
+// While one buffer is being processed, a background thread loads the next
+// chunk into the other, so loading and processing overlap and at most two
+// chunks are held at a time. The last chunk of a pass starts the load of the
+// first one of the next pass. A buffer that still holds the chunk needed is
+// not loaded again, so with one or two chunks everything stays in memory
+// after the first pass.
+//
+// load(chunk, buffer) runs on the background thread only. The first exception
+// it throws is rethrown by forEach().
+template <typename Buffer>
+class ChunkStream {
+public:
+  using Loader = std::function<void(std::size_t chunk, Buffer &buffer)>;
+
+  ChunkStream(std::size_t nChunks, Loader load) : nChunks_(nChunks), load_(std::move(load))
+  {
+    if (nChunks_ == 0) throw std::runtime_error("ChunkStream needs at least one chunk");
+    loader_ = std::thread([this] { loaderLoop(); });
+  }
+
+  ~ChunkStream()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    loader_.join();
+  }
+
+  ChunkStream(const ChunkStream &) = delete;
+  ChunkStream &operator=(const ChunkStream &) = delete;
+
+  std::size_t nChunks() const { return nChunks_; }
+
+  template <typename F>
+  void forEach(F &&process)
+  {
+    // a previous pass that stopped early may have left a load in flight
+    waitLoaded();
+
+    int slot = holding(0);
+    if (slot < 0) {
+      slot = 0;
+      startLoad(slot, 0);
+    }
+
+    for (std::size_t chunk = 0; chunk < nChunks_; ++chunk) {
+      waitLoaded();
+
+      const std::size_t next = (chunk + 1) % nChunks_;
+      if (held_[1 - slot] != next && held_[slot] != next) startLoad(1 - slot, next);
+
+      process(chunk, buffers_[slot]);
+      slot = 1 - slot;
+      if (held_[slot] != next) slot = 1 - slot; // only one chunk, still in this buffer
+    }
+  }
+
+private:
+  static constexpr std::size_t kNone = static_cast<std::size_t>(-1);
+
+  int holding(std::size_t chunk) const
+  {
+    for (int slot = 0; slot < 2; ++slot) {
+      if (held_[slot] == chunk) return slot;
+    }
+    return -1;
+  }
+
+  void startLoad(int slot, std::size_t chunk)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      held_[slot] = chunk;
+      loadSlot_ = slot;
+    }
+    wake_.notify_all();
+  }
+
+  // Waits for the load in flight, if any, and rethrows its exception
+  void waitLoaded()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return loadSlot_ < 0; });
+    if (error_) {
+      auto error = error_;
+      error_ = nullptr;
+      held_[0] = held_[1] = kNone;
+      std::rethrow_exception(error);
+    }
+  }
+
+  void loaderLoop()
+  {
+    while (true) {
+      int slot;
+      std::size_t chunk;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this] { return stop_ || loadSlot_ >= 0; });
+        if (stop_) return;
+        slot = loadSlot_;
+        chunk = held_[slot];
+      }
+
+      std::exception_ptr error;
+      try {
+        load_(chunk, buffers_[slot]);
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error) error_ = error;
+        loadSlot_ = -1;
+      }
+      done_.notify_all();
+    }
+  }
+
+  const std::size_t nChunks_;
+  Loader load_;
+  Buffer buffers_[2];
+
+  // chunk in each buffer, or being loaded into it
+  std::size_t held_[2]{kNone, kNone};
+
+  std::mutex mutex_;
+  std::condition_variable wake_, done_;
+  int loadSlot_{-1}; // buffer being loaded, -1 if none
+  bool stop_{false};
+  std::exception_ptr error_;
+  std::thread loader_;
+};
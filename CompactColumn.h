@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COMPACT_HAVE_X86 1
+#endif
+
+// Event columns stored in 16 bits per value instead of 32, to cut the memory
+// traffic of the event loop once it is bound by memory bandwidth. Only the
+// float columns shrink: integer columns read alongside them (e.g. spline
+// bins) keep their size, so the loop as a whole saves less than half.
+//
+// Every column picks its own format:
+// - Float16:  IEEE half precision, 11 significant bits, up to 65504
+// - BFloat16: the top half of a float, 8 significant bits, full float range
+// - Fixed16:  65536 evenly spaced values over [min, max] of the Encoding,
+//             values outside the range are clamped to it
+// - Float32:  stored as is
+//
+// Values are rounded to nearest (even) when encoding. Reading widens a range
+// of values back to floats into a small buffer, with F16C/AVX2 where the CPU
+// has it; the scalar and SIMD paths give the same floats.
+namespace Compact {
+
+enum class Format { Float32, Float16, BFloat16, Fixed16 };
+
+inline const char *formatName(Format format)
+{
+  switch (format) {
+  case Format::Float16: return "fp16";
+  case Format::BFloat16: return "bf16";
+  case Format::Fixed16: return "fixed16";
+  default: return "fp32";
+  }
+}
+
+struct Encoding {
+  Format format{Format::Float32};
+  float min{0}, max{0}; // range of Fixed16
+
+  float step() const { return (max - min) / 65535.0f; }
+};
+
+inline uint16_t toHalf(float value)
+{
+  uint32_t f;
+  std::memcpy(&f, &value, sizeof(f));
+  const uint16_t sign = (f >> 16) & 0x8000;
+  f &= 0x7fffffff;
+
+  if (f >= 0x7f800000) return sign | 0x7c00 | (f > 0x7f800000 ? 0x200 : 0); // inf, nan
+  if (f >= 0x477ff000) return sign | 0x7c00;                                 // rounds above 65504
+  if (f < 0x38800000) {
+    // subnormal (or zero) in half precision: units of 2^-24
+    std::memcpy(&value, &f, sizeof(f));
+    return sign | static_cast<uint16_t>(std::nearbyint(value * 16777216.0f));
+  }
+  const uint32_t rounded = f + 0xfff + ((f >> 13) & 1);
+  return sign | static_cast<uint16_t>((rounded >> 13) - (112 << 10));
+}
+
+inline float fromHalf(uint16_t h)
+{
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    const float value = mantissa * (1.0f / 16777216.0f);
+    return sign ? -value : value;
+  }
+  const uint32_t f = sign | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23) | (mantissa << 13);
+  float value;
+  std::memcpy(&value, &f, sizeof(f));
+  return value;
+}
+
+inline uint16_t toBFloat16(float value)
+{
+  uint32_t f;
+  std::memcpy(&f, &value, sizeof(f));
+  if ((f & 0x7fffffff) > 0x7f800000) return static_cast<uint16_t>((f >> 16) | 0x40); // keep nan a nan
+  return static_cast<uint16_t>((f + 0x7fff + ((f >> 16) & 1)) >> 16);
+}
+
+inline float fromBFloat16(uint16_t h)
+{
+  const uint32_t f = static_cast<uint32_t>(h) << 16;
+  float value;
+  std::memcpy(&value, &f, sizeof(f));
+  return value;
+}
+
+inline float fromFixed16(uint16_t code, const Encoding &encoding)
+{
+  return std::fmaf(static_cast<float>(code), encoding.step(), encoding.min);
+}
+
+enum class Kernel { Scalar, AVX2 };
+
+inline const char *kernelName(Kernel k) { return k == Kernel::AVX2 ? "F16C/AVX2" : "scalar"; }
+
+inline Kernel bestKernel()
+{
+#ifdef COMPACT_HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) {
+    return Kernel::AVX2;
+  }
+#endif
+  return Kernel::Scalar;
+}
+
+inline void widenScalar(const Encoding &encoding, const uint16_t *in, float *out, std::size_t n)
+{
+  switch (encoding.format) {
+  case Format::Float16:
+    for (std::size_t i = 0; i < n; ++i) out[i] = fromHalf(in[i]);
+    break;
+  case Format::BFloat16:
+    for (std::size_t i = 0; i < n; ++i) out[i] = fromBFloat16(in[i]);
+    break;
+  case Format::Fixed16:
+    for (std::size_t i = 0; i < n; ++i) out[i] = fromFixed16(in[i], encoding);
+    break;
+  default: throw std::runtime_error("Float32 columns are not widened");
+  }
+}
+
+#ifdef COMPACT_HAVE_X86
+
+__attribute__((target("avx2,fma,f16c"))) inline void widenAVX2(const Encoding &encoding, const uint16_t *in,
+                                                                float *out, std::size_t n)
+{
+  std::size_t i = 0;
+  switch (encoding.format) {
+  case Format::Float16:
+    for (; i + 8 <= n; i += 8) {
+      const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+      _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+    }
+    break;
+  case Format::BFloat16:
+    for (; i + 8 <= n; i += 8) {
+      const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+      _mm256_storeu_ps(out + i, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16)));
+    }
+    break;
+  case Format::Fixed16: {
+    const __m256 step = _mm256_set1_ps(encoding.step());
+    const __m256 min = _mm256_set1_ps(encoding.min);
+    for (; i + 8 <= n; i += 8) {
+      const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+      const __m256 code = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(h));
+      _mm256_storeu_ps(out + i, _mm256_fmadd_ps(code, step, min));
+    }
+    break;
+  }
+  default: break;
+  }
+  widenScalar(encoding, in + i, out + i, n - i);
+}
+
+#endif
+
+inline void widen(Kernel kernel, const Encoding &encoding, const uint16_t *in, float *out, std::size_t n)
+{
+#ifdef COMPACT_HAVE_X86
+  if (kernel == Kernel::AVX2) return widenAVX2(encoding, in, out, n);
+#endif
+  widenScalar(encoding, in, out, n);
+}
+
+// One event column in the format of its Encoding
+class Column {
+public:
+  Column() = default;
+
+  Column(const std::vector<float> &values, const Encoding &encoding) : encoding_(encoding)
+  {
+    if (encoding.format == Format::Float32) {
+      full_ = values;
+      return;
+    }
+    if (encoding.format == Format::Fixed16 && !(encoding.max > encoding.min)) {
+      throw std::runtime_error("Fixed16 needs a range with max > min");
+    }
+
+    packed_.resize(values.size());
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      packed_[i] = encode(values[i]);
+      const float error = std::abs(decode(packed_[i]) - values[i]);
+      if (error > maxError_) maxError_ = error;
+    }
+  }
+
+  const Encoding &encoding() const { return encoding_; }
+  std::size_t size() const { return encoding_.format == Format::Float32 ? full_.size() : packed_.size(); }
+  std::size_t memoryBytes() const { return full_.size() * sizeof(float) + packed_.size() * sizeof(uint16_t); }
+
+  // Values clamped to the range of a Fixed16 column when encoding
+  std::size_t clipped() const { return clipped_; }
+  // Largest difference between a stored and an original value
+  float maxError() const { return maxError_; }
+
+  float value(std::size_t i) const { return encoding_.format == Format::Float32 ? full_[i] : decode(packed_[i]); }
+
+  // Values [begin, end) as floats: a Float32 column returns them in place,
+  // the others widen them into buffer, which has room for end - begin values
+  const float *values(std::size_t begin, std::size_t end, float *buffer, Kernel kernel = Kernel::Scalar) const
+  {
+    if (encoding_.format == Format::Float32) return full_.data() + begin;
+    widen(kernel, encoding_, packed_.data() + begin, buffer, end - begin);
+    return buffer;
+  }
+
+private:
+  uint16_t encode(float value)
+  {
+    switch (encoding_.format) {
+    case Format::Float16: return toHalf(value);
+    case Format::BFloat16: return toBFloat16(value);
+    default: {
+      if (!(value >= encoding_.min && value <= encoding_.max)) ++clipped_;
+      const float code = std::nearbyint((value - encoding_.min) / encoding_.step());
+      return static_cast<uint16_t>(std::fmax(0.0f, std::fmin(code, 65535.0f)));
+    }
+    }
+  }
+
+  float decode(uint16_t h) const
+  {
+    switch (encoding_.format) {
+    case Format::Float16: return fromHalf(h);
+    case Format::BFloat16: return fromBFloat16(h);
+    default: return fromFixed16(h, encoding_);
+    }
+  }
+
+  Encoding encoding_;
+  std::vector<float> full_;
+  std::vector<uint16_t> packed_;
+  std::size_t clipped_{0};
+  float maxError_{0};
+};
+
+} // namespace Compact
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compressed sparse row map from events to the splines that reweight them.
+// The splines of event e are indices[offsets[e]] up to indices[offsets[e + 1]],
+// so events only list the splines that actually apply to them (e.g. for their
+// interaction mode and target) and all of them share two contiguous arrays
+// instead of one heap allocation per event.
+struct EventSplineMap {
+  std::vector<uint64_t> offsets{0};
+  std::vector<int32_t> indices;
+
+  std::size_t nEvents() const { return offsets.size() - 1; }
+  std::size_t nEntries() const { return indices.size(); }
+
+  const int32_t *begin(std::size_t event) const { return indices.data() + offsets[event]; }
+  const int32_t *end(std::size_t event) const { return indices.data() + offsets[event + 1]; }
+
+  std::size_t memoryBytes() const
+  {
+    return offsets.capacity() * sizeof(uint64_t) + indices.capacity() * sizeof(int32_t);
+  }
+
+  // splinesOf(event, out) appends the indices of the splines applying to the
+  // event to out
+  template <typename F>
+  static EventSplineMap build(std::size_t nEvents, F &&splinesOf)
+  {
+    EventSplineMap map;
+    map.offsets.reserve(nEvents + 1);
+    for (std::size_t event = 0; event < nEvents; ++event) {
+      splinesOf(event, map.indices);
+      map.offsets.push_back(map.indices.size());
+    }
+    map.indices.shrink_to_fit();
+    return map;
+  }
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <TH1D.h>
+
+// Variable-binning 1D histogram for filling in hot loops, as a stand-in for
+// TH1D::Fill: the bins are one contiguous array of doubles, with the same
+// numbering as ROOT (0 underflow, 1..nBins, nBins + 1 overflow), and there is
+// no virtual dispatch or statistics bookkeeping beyond the number of entries.
+//
+// Bins are found with a lookup table over [low edge, high edge) in cells no
+// wider than the narrowest bin, so a cell overlaps at most two bins and
+// finding the bin takes one table read and a compare instead of a binary
+// search. With sumw2 the sum of squared weights of a bin sits next to its sum
+// of weights and both are updated together.
+//
+// findBin(x, hint) first checks whether x is still in bin hint, which makes
+// refilling events whose value barely moved since the last fill (e.g. small
+// MCMC proposals) two compares, with the bin cached per event by the caller.
+//
+// reset() clears the bins but keeps all memory, so one histogram can be
+// refilled every step. toTH1D() builds a TH1D for output.
+class FastHistogram1D {
+public:
+  FastHistogram1D(const std::string &name, const std::string &title, const std::vector<double> &edges,
+                  bool sumw2 = false)
+    : name_(name), title_(title), edges_(edges), stride_(sumw2 ? 2 : 1)
+  {
+    if (edges_.size() < 2 || !std::is_sorted(edges_.begin(), edges_.end()) ||
+        std::adjacent_find(edges_.begin(), edges_.end()) != edges_.end()) {
+      throw std::runtime_error("FastHistogram1D " + name + " needs at least two increasing bin edges");
+    }
+    content_.assign((nBins() + 2) * stride_, 0.0);
+    bounds_.push_back(-INFINITY);
+    bounds_.insert(bounds_.end(), edges_.begin(), edges_.end());
+    bounds_.push_back(INFINITY);
+    buildLookup();
+  }
+
+  int nBins() const { return static_cast<int>(edges_.size()) - 1; }
+  bool hasSumw2() const { return stride_ == 2; }
+  const std::vector<double> &edges() const { return edges_; }
+
+  int findBin(double x) const
+  {
+    if (!(x >= edges_.front())) return 0; // also NaN, as underflow
+    if (x >= edges_.back()) return nBins() + 1;
+
+    const auto cell = std::min(static_cast<std::size_t>((x - edges_.front()) * invCell_), lookup_.size() - 1);
+    int bin = lookup_[cell];
+    while (x >= edges_[bin]) ++bin; // edges_[bin] is the upper edge of bin
+    while (bin > 1 && x < edges_[bin - 1]) --bin;
+    return bin;
+  }
+
+  // Bin of x, trying bin hint (which may be under/overflow) first
+  int findBin(double x, int hint) const
+  {
+    if (hint >= 0 && hint <= nBins() + 1 && x >= bounds_[hint] && x < bounds_[hint + 1]) return hint;
+    return findBin(x);
+  }
+
+  void fill(double x, double w = 1.0) { fillBin(findBin(x), w); }
+
+  // Fills x, using and updating the bin cached for it from a previous fill
+  void fill(double x, double w, int32_t &cachedBin)
+  {
+    cachedBin = findBin(x, cachedBin);
+    fillBin(cachedBin, w);
+  }
+
+  void fillBin(int bin, double w)
+  {
+    const std::size_t i = static_cast<std::size_t>(bin) * stride_;
+    content_[i] += w;
+    if (stride_ == 2) content_[i + 1] += w * w;
+    ++entries_;
+  }
+
+  void reset()
+  {
+    std::fill(content_.begin(), content_.end(), 0.0);
+    entries_ = 0;
+  }
+
+  // Adds the bins of another histogram with the same binning
+  void add(const FastHistogram1D &other)
+  {
+    if (other.edges_ != edges_ || other.stride_ != stride_) {
+      throw std::runtime_error("Cannot add FastHistogram1D " + other.name_ + " to " + name_ + ", binnings differ");
+    }
+    for (std::size_t i = 0; i < content_.size(); ++i) content_[i] += other.content_[i];
+    entries_ += other.entries_;
+  }
+
+  double binContent(int bin) const { return content_[static_cast<std::size_t>(bin) * stride_]; }
+  double binSumw2(int bin) const
+  {
+    const std::size_t i = static_cast<std::size_t>(bin) * stride_;
+    return hasSumw2() ? content_[i + 1] : content_[i];
+  }
+  int64_t entries() const { return entries_; }
+
+  // Sum of weights over the bins in range, like TH1::GetSumOfWeights
+  double sumOfWeights() const
+  {
+    double sum = 0.0;
+    for (int bin = 1; bin <= nBins(); ++bin) sum += binContent(bin);
+    return sum;
+  }
+
+  TH1D toTH1D() const
+  {
+    TH1D h(name_.c_str(), title_.c_str(), nBins(), edges_.data());
+    if (hasSumw2()) h.Sumw2();
+    for (int bin = 0; bin <= nBins() + 1; ++bin) {
+      h.SetBinContent(bin, binContent(bin));
+      if (hasSumw2()) h.SetBinError(bin, std::sqrt(binSumw2(bin)));
+    }
+    h.SetEntries(static_cast<double>(entries_));
+    return h;
+  }
+
+private:
+  void buildLookup()
+  {
+    double narrowest = edges_.back() - edges_.front();
+    for (int bin = 1; bin <= nBins(); ++bin) narrowest = std::min(narrowest, edges_[bin] - edges_[bin - 1]);
+
+    // cap the table for very fine binnings; findBin then walks a few bins
+    constexpr std::size_t kMaxCells = 1 << 16;
+    const double range = edges_.back() - edges_.front();
+    const auto nCells = std::min(kMaxCells, static_cast<std::size_t>(std::ceil(range / narrowest)));
+    invCell_ = nCells / range;
+
+    lookup_.resize(nCells);
+    for (std::size_t cell = 0; cell < nCells; ++cell) {
+      const double low = edges_.front() + cell / invCell_;
+      lookup_[cell] = static_cast<int32_t>(std::upper_bound(edges_.begin(), edges_.end(), low) - edges_.begin());
+    }
+  }
+
+  std::string name_, title_;
+  std::vector<double> edges_;
+  std::vector<double> bounds_; // edges_ with -inf and +inf around, bin b is [bounds_[b], bounds_[b + 1])
+  std::size_t stride_;
+  std::vector<double> content_;
+  int64_t entries_{0};
+
+  std::vector<int32_t> lookup_; // bin of the low edge of each cell
+  double invCell_{0.0};
+};
@@ -0,0 +1,849 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <TSpline.h>
+
+#include "BinaryFile.h"
+#include "FastSplineBankKernels.h"
+
+// Minimal allocator so that every array of the bank starts on a cache line.
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+  T *allocate(std::size_t n)
+  {
+    // aligned_alloc requires the size to be a multiple of the alignment
+    const std::size_t bytes = ((n * sizeof(T) + Alignment - 1) / Alignment) * Alignment;
+    void *p = std::aligned_alloc(Alignment, bytes);
+    if (!p) throw std::bad_alloc();
+    return static_cast<T *>(p);
+  }
+
+  void deallocate(T *p, std::size_t) { std::free(p); }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// An array of a FastSplineBank. While the bank is built it owns an
+// AlignedVector and offers the few vector operations the build needs; a bank
+// loaded from file instead views the mapped memory. Reads always go through
+// the const interface, so they work for both.
+template <typename T>
+class BankArray {
+public:
+  BankArray() = default;
+  BankArray(const BankArray &o) : owned_(o.owned_) { rebind(o); }
+  BankArray(BankArray &&o) noexcept : owned_(std::move(o.owned_)), data_(o.data_), size_(o.size_) {}
+  BankArray &operator=(BankArray o)
+  {
+    owned_.swap(o.owned_);
+    data_ = o.data_;
+    size_ = o.size_;
+    return *this;
+  }
+
+  void view(const T *data, std::size_t size)
+  {
+    AlignedVector<T>().swap(owned_);
+    data_ = data;
+    size_ = size;
+  }
+
+  const T &operator[](std::size_t i) const { return data_[i]; }
+  const T *data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const T *begin() const { return data_; }
+  const T *end() const { return data_ + size_; }
+  const T &back() const { return data_[size_ - 1]; }
+
+  // building only
+  T &operator[](std::size_t i) { return owned_[i]; }
+  T &back() { return owned_.back(); }
+  void push_back(const T &v) { owned_.push_back(v); sync(); }
+  template <typename It>
+  void append(It first, It last) { owned_.insert(owned_.end(), first, last); sync(); }
+  void assign(std::size_t n, const T &v) { owned_.assign(n, v); sync(); }
+  void clear() { owned_.clear(); sync(); }
+  void resize(std::size_t n) { owned_.resize(n); sync(); }
+  void reserve(std::size_t n) { owned_.reserve(n); sync(); }
+  void swap(AlignedVector<T> &v) { owned_.swap(v); sync(); }
+
+private:
+  void sync()
+  {
+    data_ = owned_.data();
+    size_ = owned_.size();
+  }
+
+  void rebind(const BankArray &o)
+  {
+    if (o.data_ == o.owned_.data()) sync();
+    else {
+      data_ = o.data_;
+      size_ = o.size_;
+    }
+  }
+
+  AlignedVector<T> owned_;
+  const T *data_{nullptr};
+  std::size_t size_{0};
+};
+
+// All the binned splines of all systematics, stored as one structure of
+// arrays.
+//
+// Splines are deduplicated on load: converted coefficient arrays that are
+// byte-identical are stored once (a "shape"), and every (shape, spline
+// parameter) pair is evaluated once. Spline s of the bank is such a pair: it
+// reads the knots [offset_[s], offset_[s] + nKnots_[s]) of the x/y/b/c/d
+// arrays and is driven by spline parameter param_[s]. The bins of systematic
+// i are the slots [systOffset_[i], systOffset_[i + 1]) and slotSpline_ maps
+// each slot onto its spline, so the value for (syst, bin) is the value of
+// spline index(syst, bin).
+//
+// Splines are also classified on load. Identity splines (1 everywhere) are
+// dropped and constant ones are folded into a static factor per spline bin,
+// so neither is evaluated nor multiplied per event; their slots have index()
+// -1. The classes are decided by exact comparisons of the coefficients, but
+// folding the constants changes the order of the float multiplications, so a
+// bin's spline weight matches the unclassified product only to within float
+// rounding (a few ulps), not bit for bit. The remaining splines are ordered
+// cubic, quadratic then linear, and the lower order ones get cheaper kernels.
+//
+// Optionally, Options::absTolerance/relTolerance enable an order reduction
+// pass before deduplication: the d (or c and d) coefficients of a segment
+// are dropped when the largest change this makes over the segment stays
+// within max(absTolerance, relTolerance * min |y| at its two knots).
+// reduction() reports how many segments were reduced and the largest error
+// seen against TSpline3::Eval on the reduced splines. binSplinesBegin/End(bin) list the splines whose
+// values, times staticFactor(bin), make up the spline weight of a bin.
+//
+// evaluateChanged() re-evaluates only the splines whose parameter changed
+// since the previous call on the same State, and only recomputes the bin
+// factors (see below) of the spline bins those splines are in.
+//
+// Both also leave the combined spline weight of every spline bin,
+// staticFactor(bin) times its spline values, in State::binFactor(bin), only
+// recomputing the bins that changed. The event loop then needs one lookup per
+// event however many systematics there are, at the price of multiplying in
+// a different order than a per-event product (equal to within rounding).
+// Events outside the spline binning take outsideBin(), whose factor stays 1.
+//
+// save() writes the fully built bank, together with the spline binning and
+// the systematic names, to a versioned and checksummed binary file. load()
+// maps such a file and the bank then reads all its arrays straight from the
+// mapping, so restarting needs neither ROOT nor any conversion.
+//
+// The bank is read-only once built. Everything that changes from one
+// evaluation to the next lives in a State, so several threads or chains can
+// share one bank, each evaluating into its own State.
+class FastSplineBank {
+public:
+  enum class SplineClass { Identity, Constant, Linear, Quadratic, Cubic };
+
+  struct Options {
+    float absTolerance{0.0f}; // order reduction is off when both are 0
+    float relTolerance{0.0f};
+  };
+
+  struct ReductionReport {
+    long segments{0};
+    long quadraticSegments{0};
+    long linearSegments{0};
+    double maxAbsError{0.0};
+    double maxRelError{0.0};
+  };
+
+  struct State {
+    AlignedVector<float> values;     // one per spline
+    AlignedVector<float> binFactors; // one per spline bin, then the outside bin
+
+    // parameters of the last evaluation
+    std::vector<float> params;
+    // scratch of evaluateChanged: splines to re-evaluate, bins to recompute
+    std::vector<uint8_t> dirtyBin;
+    std::vector<int32_t> dirtySplines, dirtyBins;
+
+    float value(int s) const { return values[s]; }
+    float binFactor(int bin) const { return binFactors[bin]; }
+  };
+
+  FastSplineBank() = default;
+
+  explicit FastSplineBank(const std::vector<std::vector<TSpline3 *>> &splines)
+    : FastSplineBank(splines, Options())
+  {
+  }
+
+  FastSplineBank(const std::vector<std::vector<TSpline3 *>> &splines, const Options &options)
+    : options_(options)
+  {
+    Dedup dedup;
+    systOffset_.reserve(splines.size() + 1);
+    systOffset_.push_back(0);
+
+    for (size_t i = 0; i < splines.size(); ++i) {
+      for (auto *s : splines[i]) {
+        slotSpline_.push_back(addSpline(*s, static_cast<int>(i), dedup));
+      }
+      systOffset_.push_back(nSlots());
+    }
+    nShapes_ = dedup.nShapes;
+
+    classify();
+  }
+
+  // Binary format (see BinaryFile.h): one section per array plus the scalars
+  // and systematic names. load() maps the file and reads the arrays in place,
+  // so startup does not depend on ROOT or on the number of splines; the
+  // mapping lives as long as the bank (or any copy of it).
+  static constexpr const char *kFileMagic = "MACH3SPL";
+  static constexpr uint32_t kFileVersion = 2;
+
+  void save(const std::string &path) const
+  {
+    BinaryFile::Writer writer(kFileMagic, kFileVersion);
+    forEachArray([&writer](const char *name, const auto &a) {
+      writer.add(name, a.data(), a.size() * sizeof(a[0]));
+    });
+
+    Meta meta{};
+    meta.nShapes = nShapes_;
+    meta.cubicEnd = cubicEnd_;
+    meta.quadraticEnd = quadraticEnd_;
+    std::copy(std::begin(slotClassCount_), std::end(slotClassCount_), meta.slotClassCount);
+    meta.options = options_;
+    meta.reduction = reduction_;
+    meta.sourceHash = sourceHash_;
+    writer.add("meta", &meta, sizeof(Meta));
+
+    std::string names;
+    for (const auto &name : systNames_) names += name + '\0';
+    writer.add("systNames", names.data(), names.size());
+
+    writer.write(path);
+  }
+
+  static FastSplineBank load(const std::string &path, bool verifyChecksum = true)
+  {
+    BinaryFile::Reader reader(path, kFileMagic, kFileVersion, verifyChecksum);
+
+    FastSplineBank bank;
+    bank.mapping_ = reader.file();
+    bank.forEachArray([&reader](const char *name, auto &a) {
+      using T = std::decay_t<decltype(a[0])>;
+      std::size_t count;
+      const T *data = reader.section<T>(name, count);
+      a.view(data, count);
+    });
+
+    const auto &meta = reader.scalar<Meta>("meta");
+    bank.nShapes_ = meta.nShapes;
+    bank.cubicEnd_ = meta.cubicEnd;
+    bank.quadraticEnd_ = meta.quadraticEnd;
+    std::copy(std::begin(meta.slotClassCount), std::end(meta.slotClassCount), bank.slotClassCount_);
+    bank.options_ = meta.options;
+    bank.reduction_ = meta.reduction;
+    bank.sourceHash_ = meta.sourceHash;
+
+    std::size_t size;
+    const char *names = reader.section<char>("systNames", size);
+    std::vector<std::string> systNames;
+    for (std::size_t i = 0; i < size; i += systNames.back().size() + 1) systNames.emplace_back(names + i);
+    if (!systNames.empty()) bank.setSystNames(systNames);
+
+    return bank;
+  }
+
+  // Spline binning (in the true neutrino energy) the bins of the bank refer to
+  void setBinEdges(const std::vector<float> &edges)
+  {
+    binEdges_.clear();
+    binEdges_.append(edges.begin(), edges.end());
+  }
+  std::vector<float> binEdges() const { return std::vector<float>(binEdges_.begin(), binEdges_.end()); }
+
+  // Identifies what the bank was built from (e.g. a hash of the spline file's
+  // path, size and modification time), so that a saved bank can be checked
+  // against its source before it is used
+  void setSourceHash(uint64_t hash) { sourceHash_ = hash; }
+  uint64_t sourceHash() const { return sourceHash_; }
+
+  void setSystNames(const std::vector<std::string> &names)
+  {
+    if (static_cast<int>(names.size()) != nSysts()) throw std::runtime_error("Need one name per systematic");
+    systNames_ = names;
+    systIndex_.clear();
+    for (int i = 0; i < nSysts(); ++i) systIndex_.emplace(names[i], i);
+  }
+  const std::string &systName(int syst) const { return systNames_[syst]; }
+  int findSyst(const std::string &name) const
+  {
+    auto it = systIndex_.find(name);
+    return it == systIndex_.end() ? -1 : it->second;
+  }
+
+  State createState() const
+  {
+    State state;
+    state.values.assign(nSplines(), 1.0f);
+    state.dirtyBin.assign(nSplineBins(), 0);
+    state.binFactors.assign(nSplineBins() + 1, 1.0f);
+    for (int bin = 0; bin < nSplineBins(); ++bin) updateBinFactor(bin, state);
+    return state;
+  }
+
+  int nSysts() const { return systOffset_.empty() ? 0 : static_cast<int>(systOffset_.size()) - 1; }
+  int nBins(int syst) const { return systOffset_[syst + 1] - systOffset_[syst]; }
+  int nSlots() const { return static_cast<int>(slotSpline_.size()); }
+  int nShapes() const { return nShapes_; }
+  int nSplines() const { return static_cast<int>(offset_.size()); }
+  int nKnotsTotal() const { return static_cast<int>(x_.size()); }
+
+  int nCubic() const { return cubicEnd_; }
+  int nQuadratic() const { return quadraticEnd_ - cubicEnd_; }
+  int nLinear() const { return nSplines() - quadraticEnd_; }
+  const ReductionReport &reduction() const { return reduction_; }
+  const Options &options() const { return options_; }
+  int nSplineBins() const { return static_cast<int>(staticFactor_.size()); }
+  // Bin after the last spline bin, whose factor is always 1, for events
+  // outside the spline binning
+  int outsideBin() const { return nSplineBins(); }
+  int nParams() const { return static_cast<int>(paramSplineOffset_.size()) - 1; }
+
+  // spline evaluated for (syst, bin), or -1 if it is constant
+  int index(int syst, int bin) const { return slotSpline_[systOffset_[syst] + bin]; }
+
+  float staticFactor(int bin) const { return staticFactor_[bin]; }
+  const int32_t *binSplinesBegin(int bin) const { return binSplines_.data() + binSplineOffset_[bin]; }
+  const int32_t *binSplinesEnd(int bin) const { return binSplines_.data() + binSplineOffset_[bin + 1]; }
+
+  // value of (syst, bin) after evaluateAll, including constant slots
+  float value(const State &state, int syst, int bin) const
+  {
+    const int s = index(syst, bin);
+    return s < 0 ? slotConstant_[systOffset_[syst] + bin] : state.value(s);
+  }
+
+  float evalSlot(int syst, int bin, float x) const
+  {
+    const int s = index(syst, bin);
+    return s < 0 ? slotConstant_[systOffset_[syst] + bin] : eval(s, x);
+  }
+
+  std::size_t memoryBytes() const
+  {
+    return 5 * x_.size() * sizeof(float) + 3 * offset_.size() * sizeof(int32_t) +
+           2 * x0_.size() * sizeof(float) + slotSpline_.size() * (sizeof(int32_t) + sizeof(float)) +
+           systOffset_.size() * sizeof(int32_t) + staticFactor_.size() * sizeof(float) +
+           (binSplineOffset_.size() + binSplines_.size() + paramSplineOffset_.size() + paramSplines_.size() +
+            splineBinOffset_.size() + splineBins_.size()) *
+               sizeof(int32_t);
+  }
+
+  void printSummary() const
+  {
+    std::cout << "Spline bank: " << nSlots() << " binned splines, " << nShapes() << " unique shapes, "
+              << nSplines() << " evaluated per step, " << memoryBytes() / 1024.0 << " kB" << std::endl;
+    std::cout << "  identity (removed): " << slotClassCount_[0] << ", constant (folded): " << slotClassCount_[1]
+              << ", linear: " << slotClassCount_[2] << ", quadratic: " << slotClassCount_[3]
+              << ", cubic: " << slotClassCount_[4] << std::endl;
+    if (options_.absTolerance > 0.0f || options_.relTolerance > 0.0f) {
+      std::cout << "  order reduction: " << reduction_.quadraticSegments << " quadratic and "
+                << reduction_.linearSegments << " linear segments out of " << reduction_.segments
+                << ", max error vs TSpline3: " << reduction_.maxAbsError << " (abs), " << reduction_.maxRelError
+                << " (rel)" << std::endl;
+    }
+  }
+
+  // Evaluate every spline in the bank at its own entry of params into
+  // state.values. Uses the widest SIMD kernel the CPU supports, see
+  // FastSplineBankKernels.h for the accuracy guarantees.
+  void evaluateAll(const std::vector<float> &params, State &state) const
+  {
+    evaluateRange(params, state, 0, nSplines());
+    updateBinFactors(state, 0, nSplineBins());
+    markEvaluated(params, state);
+  }
+
+  // The steps of evaluateAll, for splitting it into parallel tasks:
+  // evaluateRange() on disjoint ranges of splines, then, once all splines
+  // are done, updateBinFactors() on disjoint ranges of bins and
+  // markEvaluated() to record params as fully evaluated in state.
+  void evaluateRange(const std::vector<float> &params, State &state, int begin, int end) const
+  {
+    auto clamp = [begin, end](int s) { return std::min(std::max(s, begin), end); };
+    SplineKernels::eval<3>(kernel_, view(), params.data(), state.values.data(), clamp(0), clamp(cubicEnd_));
+    SplineKernels::eval<2>(kernel_, view(), params.data(), state.values.data(), clamp(cubicEnd_),
+                           clamp(quadraticEnd_));
+    SplineKernels::eval<1>(kernel_, view(), params.data(), state.values.data(), clamp(quadraticEnd_),
+                           clamp(nSplines()));
+  }
+
+  void updateBinFactors(State &state, int binBegin, int binEnd) const
+  {
+    for (int bin = binBegin; bin < binEnd; ++bin) updateBinFactor(bin, state);
+  }
+
+  void markEvaluated(const std::vector<float> &params, State &state) const
+  {
+    clearDirty(state);
+    state.params = params;
+  }
+
+  // Like evaluateAll, but only re-evaluates the splines of parameters that
+  // differ from the previous call on state. Falls back to evaluateAll on the
+  // first call or when more than a quarter of the splines changed, where the
+  // SIMD kernels over everything win. The values are identical either way.
+  void evaluateChanged(const std::vector<float> &params, State &state) const
+  {
+    if (params.size() != state.params.size()) return evaluateAll(params, state);
+
+    clearDirty(state);
+
+    for (int p = 0; p < nParams(); ++p) {
+      if (params[p] == state.params[p]) continue;
+      for (int i = paramSplineOffset_[p]; i < paramSplineOffset_[p + 1]; ++i) {
+        state.dirtySplines.push_back(paramSplines_[i]);
+      }
+      if (static_cast<int>(state.dirtySplines.size()) * 4 > nSplines()) return evaluateAll(params, state);
+    }
+
+    for (int s : state.dirtySplines) {
+      state.values[s] = eval(s, params[param_[s]]);
+      for (int i = splineBinOffset_[s]; i < splineBinOffset_[s + 1]; ++i) {
+        const int bin = splineBins_[i];
+        if (!state.dirtyBin[bin]) {
+          state.dirtyBin[bin] = 1;
+          state.dirtyBins.push_back(bin);
+        }
+      }
+    }
+    for (int bin : state.dirtyBins) updateBinFactor(bin, state);
+    state.params = params;
+  }
+
+  SplineKernels::Kernel kernel() const { return kernel_; }
+  void setKernel(SplineKernels::Kernel kernel) { kernel_ = kernel; }
+
+  SplineBankView view() const
+  {
+    return SplineBankView{x_.data(),      y_.data(),      b_.data(),     c_.data(),     d_.data(),
+                          offset_.data(), nKnots_.data(), param_.data(), x0_.data(),    invDx_.data(),
+                          nSplines()};
+  }
+
+  float eval(int s, float x) const
+  {
+    const int off = offset_[s];
+    const int n = nKnots_[s];
+    if (n == 1) return y_[off];
+
+    const int seg = invDx_[s] > 0.0f ? SplineKernels::uniformSegment(x, x0_[s], invDx_[s], n)
+                                     : findSegment(&x_[off], n, x);
+    const int k = off + seg;
+    const float dx = x - x_[k];
+    return fmaf(dx, fmaf(dx, fmaf(dx, d_[k], c_[k]), b_[k]), y_[k]);
+  }
+
+  bool hasUniformKnots(int s) const { return invDx_[s] > 0.0f; }
+
+  // Same segment convention as FastTSpline3Eval: clamp to the first/last
+  // segment outside the knot range, otherwise the last knot strictly below x.
+  static int findSegment(const float *xs, int n, float x)
+  {
+    if (n <= 2) return 0;
+    if (x <= xs[0]) return 0;
+    if (x >= xs[n - 1]) return n - 2;
+
+    int low = 0;
+    int high = n - 1;
+    while (high - low > 1) {
+      const int mid = (low + high) / 2;
+      if (x > xs[mid]) low = mid;
+      else high = mid;
+    }
+    return low;
+  }
+
+private:
+  // Scalars stored alongside the arrays in a saved bank
+  struct Meta {
+    int32_t nShapes, cubicEnd, quadraticEnd;
+    int32_t slotClassCount[5];
+    Options options;
+    ReductionReport reduction;
+    uint64_t sourceHash;
+  };
+
+  // Calls f(name, array) for every array that is saved with the bank
+  template <typename F>
+  void forEachArray(F &&f)
+  {
+    f("x", x_), f("y", y_), f("b", b_), f("c", c_), f("d", d_);
+    f("offset", offset_), f("nKnots", nKnots_), f("param", param_), f("x0", x0_), f("invDx", invDx_);
+    f("slotSpline", slotSpline_), f("slotConstant", slotConstant_), f("systOffset", systOffset_);
+    f("staticFactor", staticFactor_), f("binSplineOffset", binSplineOffset_), f("binSplines", binSplines_);
+    f("paramSplineOffset", paramSplineOffset_), f("paramSplines", paramSplines_);
+    f("splineBinOffset", splineBinOffset_), f("splineBins", splineBins_), f("binEdges", binEdges_);
+  }
+
+  template <typename F>
+  void forEachArray(F &&f) const
+  {
+    const_cast<FastSplineBank *>(this)->forEachArray([&f](const char *name, const auto &a) { f(name, a); });
+  }
+
+  // Lookup tables only needed while building the bank
+  struct Dedup {
+    std::unordered_map<uint64_t, std::vector<int>> shapeOffsets; // content hash -> knot offsets
+    std::unordered_map<int, int> shapeKnots;                     // knot offset -> number of knots
+    std::unordered_map<uint64_t, int> splines;                   // (knot offset, param) -> spline
+    int nShapes{0};
+  };
+
+  // FNV-1a over the bytes of the converted coefficients
+  static uint64_t hashCoeffs(const std::vector<float> (&coeffs)[5])
+  {
+    uint64_t h = 14695981039346656037ull;
+    for (const auto &a : coeffs) {
+      const auto *bytes = reinterpret_cast<const unsigned char *>(a.data());
+      for (std::size_t i = 0; i < a.size() * sizeof(float); ++i) {
+        h = (h ^ bytes[i]) * 1099511628211ull;
+      }
+    }
+    return h;
+  }
+
+  bool sameShape(int off, const std::vector<float> (&coeffs)[5]) const
+  {
+    const std::size_t bytes = coeffs[0].size() * sizeof(float);
+    const BankArray<float> *arrays[5] = {&x_, &y_, &b_, &c_, &d_};
+    for (int a = 0; a < 5; ++a) {
+      if (std::memcmp(arrays[a]->data() + off, coeffs[a].data(), bytes) != 0) return false;
+    }
+    return true;
+  }
+
+  // Returns the spline evaluating spl at parameter param, adding the shape
+  // and/or the spline if they are not in the bank yet.
+  int addSpline(const TSpline3 &spl, int param, Dedup &dedup)
+  {
+    const int n = spl.GetNp();
+    if (n <= 0) throw std::runtime_error("TSpline3 has no points");
+
+    std::vector<float> coeffs[5];
+    for (auto &a : coeffs) a.resize(n);
+    for (int i = 0; i < n; ++i) {
+      double x, y, b, c, d;
+      spl.GetCoeff(i, x, y, b, c, d);
+      coeffs[0][i] = static_cast<float>(x);
+      coeffs[1][i] = static_cast<float>(y);
+      coeffs[2][i] = static_cast<float>(b);
+      coeffs[3][i] = static_cast<float>(c);
+      coeffs[4][i] = static_cast<float>(d);
+    }
+    if (options_.absTolerance > 0.0f || options_.relTolerance > 0.0f) reduceOrder(spl, coeffs);
+
+    auto &candidates = dedup.shapeOffsets[hashCoeffs(coeffs)];
+    int off = -1;
+    for (int candidate : candidates) {
+      if (dedup.shapeKnots.at(candidate) == n && sameShape(candidate, coeffs)) {
+        off = candidate;
+        break;
+      }
+    }
+    if (off < 0) {
+      off = nKnotsTotal();
+      candidates.push_back(off);
+      dedup.shapeKnots.emplace(off, n);
+      dedup.nShapes++;
+      x_.append(coeffs[0].begin(), coeffs[0].end());
+      y_.append(coeffs[1].begin(), coeffs[1].end());
+      b_.append(coeffs[2].begin(), coeffs[2].end());
+      c_.append(coeffs[3].begin(), coeffs[3].end());
+      d_.append(coeffs[4].begin(), coeffs[4].end());
+    }
+
+    const uint64_t key = (static_cast<uint64_t>(off) << 32) | static_cast<uint32_t>(param);
+    auto it = dedup.splines.find(key);
+    if (it != dedup.splines.end()) return it->second;
+
+    const int s = nSplines();
+    dedup.splines.emplace(key, s);
+    offset_.push_back(off);
+    nKnots_.push_back(n);
+    param_.push_back(param);
+    detectUniformKnots(off, n);
+    return s;
+  }
+
+  SplineClass classOf(int s) const
+  {
+    const int off = offset_[s];
+    const int n = nKnots_[s];
+    bool flat = true;
+    bool linear = true;
+    bool quadratic = true;
+    // the coefficients of the last knot are never evaluated, unless it is the only one
+    for (int k = off; k < off + std::max(n - 1, 1); ++k) {
+      if (d_[k] != 0.0f) quadratic = false;
+      if (c_[k] != 0.0f || d_[k] != 0.0f) linear = false;
+      if (b_[k] != 0.0f || y_[k] != y_[off]) flat = false;
+    }
+    if (linear && flat) return y_[off] == 1.0f ? SplineClass::Identity : SplineClass::Constant;
+    if (linear) return SplineClass::Linear;
+    return quadratic ? SplineClass::Quadratic : SplineClass::Cubic;
+  }
+
+  template <typename T>
+  static void permute(BankArray<T> &a, const std::vector<int> &order)
+  {
+    AlignedVector<T> permuted;
+    permuted.reserve(order.size());
+    for (int s : order) permuted.push_back(a[s]);
+    a.swap(permuted);
+  }
+
+  // Drop the constant splines, order the rest cubic, quadratic then linear,
+  // and build the per spline bin tables.
+  void classify()
+  {
+    const int n = nSplines();
+    std::vector<SplineClass> cls(n);
+    for (int s = 0; s < n; ++s) cls[s] = classOf(s);
+
+    std::vector<int> order;
+    for (auto wanted : {SplineClass::Cubic, SplineClass::Quadratic, SplineClass::Linear}) {
+      for (int s = 0; s < n; ++s) {
+        if (cls[s] == wanted) order.push_back(s);
+      }
+      if (wanted == SplineClass::Cubic) cubicEnd_ = static_cast<int>(order.size());
+      if (wanted == SplineClass::Quadratic) quadraticEnd_ = static_cast<int>(order.size());
+    }
+
+    std::vector<int> newIndex(n, -1);
+    for (size_t i = 0; i < order.size(); ++i) newIndex[order[i]] = static_cast<int>(i);
+
+    slotConstant_.assign(nSlots(), 1.0f);
+    for (int slot = 0; slot < nSlots(); ++slot) {
+      const int s = slotSpline_[slot];
+      slotClassCount_[static_cast<int>(cls[s])]++;
+      if (newIndex[s] < 0) slotConstant_[slot] = y_[offset_[s]];
+      slotSpline_[slot] = newIndex[s];
+    }
+
+    permute(offset_, order);
+    permute(nKnots_, order);
+    permute(param_, order);
+    permute(x0_, order);
+    permute(invDx_, order);
+
+    int nBinsMax = 0;
+    for (int i = 0; i < nSysts(); ++i) nBinsMax = std::max(nBinsMax, nBins(i));
+
+    staticFactor_.assign(nBinsMax, 1.0f);
+    binSplineOffset_.assign(1, 0);
+    for (int bin = 0; bin < nBinsMax; ++bin) {
+      for (int i = 0; i < nSysts(); ++i) {
+        if (bin >= nBins(i)) continue;
+        const int slot = systOffset_[i] + bin;
+        if (slotSpline_[slot] < 0) staticFactor_[bin] *= slotConstant_[slot];
+        else binSplines_.push_back(slotSpline_[slot]);
+      }
+      binSplineOffset_.push_back(static_cast<int32_t>(binSplines_.size()));
+    }
+
+    buildReverseTables();
+  }
+
+  // parameter -> splines and spline -> bins, for evaluateChanged
+  void buildReverseTables()
+  {
+    int nParams = 0;
+    for (int s = 0; s < nSplines(); ++s) nParams = std::max(nParams, param_[s] + 1);
+    paramSplineOffset_.assign(nParams + 1, 0);
+    for (int s = 0; s < nSplines(); ++s) paramSplineOffset_[param_[s] + 1]++;
+    for (int p = 0; p < nParams; ++p) paramSplineOffset_[p + 1] += paramSplineOffset_[p];
+    paramSplines_.resize(nSplines());
+    std::vector<int32_t> fill(paramSplineOffset_.begin(), paramSplineOffset_.end() - 1);
+    for (int s = 0; s < nSplines(); ++s) paramSplines_[fill[param_[s]]++] = s;
+
+    std::vector<std::vector<int32_t>> bins(nSplines());
+    for (int bin = 0; bin < nSplineBins(); ++bin) {
+      for (auto it = binSplinesBegin(bin); it != binSplinesEnd(bin); ++it) {
+        if (bins[*it].empty() || bins[*it].back() != bin) bins[*it].push_back(bin);
+      }
+    }
+    splineBinOffset_.assign(1, 0);
+    for (const auto &b : bins) {
+      splineBins_.append(b.begin(), b.end());
+      splineBinOffset_.push_back(static_cast<int32_t>(splineBins_.size()));
+    }
+  }
+
+  // Multiplies in the order of binSplinesBegin/End(bin). The event loops then
+  // multiply the normalisation weight in last, where the per-event product
+  // used to start with it, so event weights differ from that product by
+  // float rounding only: a relative difference of at most about
+  // (number of splines in the bin + 2) * 2^-24.
+  void updateBinFactor(int bin, State &state) const
+  {
+    float factor = staticFactor_[bin];
+    for (auto it = binSplinesBegin(bin); it != binSplinesEnd(bin); ++it) factor *= state.values[*it];
+    state.binFactors[bin] = factor;
+  }
+
+  static void clearDirty(State &state)
+  {
+    for (int bin : state.dirtyBins) state.dirtyBin[bin] = 0;
+    state.dirtySplines.clear();
+    state.dirtyBins.clear();
+  }
+
+  // Largest |c dx^2 + d dx^3| (or |d dx^3| without c) for dx in [0, h]
+  static double droppedTermsMax(double c, double d, double h)
+  {
+    auto f = [c, d](double dx) { return std::abs(dx * dx * (c + d * dx)); };
+    double worst = f(h);
+    const double extremum = d != 0.0 ? -2.0 * c / (3.0 * d) : -1.0;
+    if (extremum > 0.0 && extremum < h) worst = std::max(worst, f(extremum));
+    return worst;
+  }
+
+  // Drop the d, or c and d, coefficients of every segment where this stays
+  // within the error budget, then measure the result against spl.
+  void reduceOrder(const TSpline3 &spl, std::vector<float> (&coeffs)[5])
+  {
+    const int n = static_cast<int>(coeffs[0].size());
+    bool reduced = false;
+
+    // knot n - 1 only starts the extrapolation past the last knot and is
+    // never evaluated, except for single knot splines
+    for (int k = 0; k + 1 < n; ++k) {
+      const double h = static_cast<double>(coeffs[0][k + 1]) - coeffs[0][k];
+      const double c = coeffs[3][k];
+      const double d = coeffs[4][k];
+      const double yMin = std::min(std::abs(coeffs[1][k]), std::abs(coeffs[1][k + 1]));
+      const double budget = std::max<double>(options_.absTolerance, options_.relTolerance * yMin);
+
+      reduction_.segments++;
+      if (c == 0.0 && d == 0.0) continue;
+      if (droppedTermsMax(c, d, h) <= budget) {
+        coeffs[3][k] = 0.0f;
+        coeffs[4][k] = 0.0f;
+        reduction_.linearSegments++;
+        reduced = true;
+      } else if (d != 0.0 && droppedTermsMax(0.0, d, h) <= budget) {
+        coeffs[4][k] = 0.0f;
+        reduction_.quadraticSegments++;
+        reduced = true;
+      }
+    }
+    if (!reduced) return;
+
+    // compare at a few points inside every segment, in the spirit of
+    // checkSplines in optimised_splines.cpp
+    for (int k = 0; k + 1 < n; ++k) {
+      for (int i = 0; i < 8; ++i) {
+        const float x = coeffs[0][k] + (coeffs[0][k + 1] - coeffs[0][k]) * ((i + 0.5f) / 8.0f);
+        const float dx = x - coeffs[0][k];
+        const float y =
+            fmaf(dx, fmaf(dx, fmaf(dx, coeffs[4][k], coeffs[3][k]), coeffs[2][k]), coeffs[1][k]);
+        const double ref = spl.Eval(x);
+        const double err = std::abs(y - ref);
+        reduction_.maxAbsError = std::max(reduction_.maxAbsError, err);
+        if (ref != 0.0) reduction_.maxRelError = std::max(reduction_.maxRelError, err / std::abs(ref));
+      }
+    }
+  }
+
+  // Same criterion as FastTSpline3Eval: every knot spacing must match the mean
+  // one to 1e-5 relative.
+  void detectUniformKnots(int off, int n)
+  {
+    x0_.push_back(x_[off]);
+    invDx_.push_back(0.0f);
+    if (n <= 2) return;
+
+    const double dx = (static_cast<double>(x_[off + n - 1]) - x_[off]) / (n - 1);
+    if (!(dx > 0.0)) return;
+    for (int i = off; i < off + n - 1; ++i) {
+      const double step = static_cast<double>(x_[i + 1]) - x_[i];
+      if (std::abs(step - dx) > 1e-5 * dx) return;
+    }
+    invDx_.back() = static_cast<float>(1.0 / dx);
+  }
+
+  // knots, one entry per knot of every unique shape
+  BankArray<float> x_, y_, b_, c_, d_;
+
+  // one entry per evaluated (shape, parameter) spline
+  BankArray<int32_t> offset_, nKnots_, param_;
+  BankArray<float> x0_, invDx_;
+
+  // one entry per (systematic, bin) slot
+  BankArray<int32_t> slotSpline_;
+  BankArray<float> slotConstant_;
+
+  // one entry per spline bin (plus the end for the offsets)
+  BankArray<float> staticFactor_;
+  BankArray<int32_t> binSplineOffset_, binSplines_;
+
+  // reverse tables (plus the end for the offsets)
+  BankArray<int32_t> paramSplineOffset_, paramSplines_;
+  BankArray<int32_t> splineBinOffset_, splineBins_;
+
+  // one entry per systematic, plus the end
+  BankArray<int32_t> systOffset_;
+
+  BankArray<float> binEdges_;
+  std::vector<std::string> systNames_;
+  std::unordered_map<std::string, int> systIndex_;
+
+  int nShapes_{0};
+  int cubicEnd_{0};
+  int quadraticEnd_{0};
+  int slotClassCount_[5]{};
+
+  // keeps the arrays of a loaded bank alive
+  std::shared_ptr<BinaryFile::MappedFile> mapping_;
+
+  Options options_;
+  ReductionReport reduction_;
+  uint64_t sourceHash_{0};
+
+  SplineKernels::Kernel kernel_{SplineKernels::bestKernel()};
+};
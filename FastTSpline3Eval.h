@@ -24,34 +24,38 @@ public:
       };
     }
 
-    currSegment_ = 0;
+    detectUniformKnots();
   }
 
   int nPoints() const { return static_cast<int>(coeffs_.size()); }
 
-  int findSegment(float x) const
+  bool hasUniformKnots() const { return invDx_ > 0.0f; }
+
+  // Per-thread (or per-chain) evaluation state: the segment found by the
+  // last evaluation, used as a hint for the next one, and the last value.
+  // The spline itself is never modified, so any number of threads can
+  // evaluate one instance as long as each passes its own State.
+  struct State {
+    int segment{0};
+    float value{1.0f};
+  };
+
+  // Segment of x, trying hint first before falling back to a binary search.
+  int findSegment(float x, int hint = 0) const
   {
     const int n = nPoints();
     if (n <= 2) return 0;
 
-    if (x <= coeffs_[0].x) {
-      currSegment_ = 0;
-      return 0;
-    }
+    if (hasUniformKnots()) return findUniformSegment(x);
 
-    if (x >= coeffs_[n - 1].x) {
-      currSegment_ = n - 2;
-      return currSegment_;
-    }
+    if (x <= coeffs_[0].x) return 0;
+    if (x >= coeffs_[n - 1].x) return n - 2;
 
-    int seg = currSegment_;
+    int seg = hint;
     if (seg < 0) seg = 0;
     if (seg > n - 2) seg = n - 2;
 
-    if (x >= coeffs_[seg].x && x < coeffs_[seg + 1].x) {
-      currSegment_ = seg;
-      return seg;
-    }
+    if (x >= coeffs_[seg].x && x < coeffs_[seg + 1].x) return seg;
 
     int low = 0;
     int high = n - 1;
@@ -65,7 +69,6 @@ public:
     seg = low;
     if (seg > n - 2) seg = n - 2;
 
-    currSegment_ = seg;
     return seg;
   }
 
@@ -84,29 +87,56 @@ public:
     return fmaf(dx, fmaf(dx, fmaf(dx, c.d, c.c), c.b), c.y);
   }
 
+  // Stateless evaluation
   float Eval(float x) const
   {
-    const int seg = findSegment(x);
-    cached_value_ = evalSegment(x, seg);
-    return cached_value_;
+    return evalSegment(x, findSegment(x));
   }
 
-  float EvalFast(float x) const
+  // Evaluation using and updating the caller's segment hint and cached value
+  float Eval(float x, State& state) const
   {
-    const Coeff& c = coeffs_[currSegment_];
-    const float dx = x - c.x;
-
-    cached_value_ = fmaf(dx, fmaf(dx, fmaf(dx, c.d, c.c), c.b), c.y);
-    return cached_value_;
+    state.segment = findSegment(x, state.segment);
+    state.value = evalSegment(x, state.segment);
+    return state.value;
   }
 
-  float GetCachedValue() const
+  // Evaluation in the segment of the previous call, without any search
+  float EvalFast(float x, State& state) const
   {
-    return cached_value_;
+    state.value = evalSegment(x, state.segment);
+    return state.value;
   }
 
 private:
+  // Knots on a regular grid: the segment is floor((x - x0) / dx) clamped to
+  // [0, n - 2], computed without branches or reading the knots.
+  int findUniformSegment(float x) const
+  {
+    const float t = (x - x0_) * invDx_;
+    return static_cast<int>(std::fmax(std::fmin(t, static_cast<float>(nPoints() - 2)), 0.0f));
+  }
+
+  // Knots count as uniform if every spacing matches the mean one to 1e-5
+  // relative, which is well below the float precision of the stored knots.
+  void detectUniformKnots()
+  {
+    const int n = nPoints();
+    invDx_ = 0.0f;
+    if (n <= 2) return;
+
+    const double dx = (static_cast<double>(coeffs_[n - 1].x) - coeffs_[0].x) / (n - 1);
+    if (!(dx > 0.0)) return;
+    for (int i = 0; i < n - 1; ++i) {
+      const double step = static_cast<double>(coeffs_[i + 1].x) - coeffs_[i].x;
+      if (std::abs(step - dx) > 1e-5 * dx) return;
+    }
+
+    x0_ = coeffs_[0].x;
+    invDx_ = static_cast<float>(1.0 / dx);
+  }
+
   std::vector<Coeff> coeffs_;
-  mutable int currSegment_{0};
-  mutable float cached_value_{0.0f};
+  float x0_{0.0f};
+  float invDx_{0.0f}; // 0 for non-uniform knots
 };
\ No newline at end of file
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Minimal NUMA support without libnuma: the topology comes from
+// /sys/devices/system/node, threads are bound with the affinity calls and the
+// memory policy is set through the set_mempolicy system call. On machines
+// (or kernels) without NUMA information everything is one node.
+namespace Numa {
+
+struct Node {
+  int id;
+  std::vector<int> cpus; // CPUs of the node this process may run on
+};
+
+// Parses a kernel CPU list such as "0-3,8-11"
+inline std::vector<int> parseCpuList(const std::string &list)
+{
+  std::vector<int> cpus;
+  std::size_t pos = 0;
+  while (pos < list.size()) {
+    std::size_t end = list.find(',', pos);
+    if (end == std::string::npos) end = list.size();
+    const std::string range = list.substr(pos, end - pos);
+    const std::size_t dash = range.find('-');
+    try {
+      const int first = std::stoi(range.substr(0, dash));
+      const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    } catch (const std::exception &) {
+      // blank or malformed entry, e.g. the trailing newline
+    }
+    pos = end + 1;
+  }
+  return cpus;
+}
+
+inline std::vector<int> allowedCpus()
+{
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+  }
+#endif
+  return cpus;
+}
+
+// Nodes with at least one CPU this process may run on
+inline std::vector<Node> topology()
+{
+  const auto allowed = allowedCpus();
+  std::vector<Node> nodes;
+
+  std::ifstream online("/sys/devices/system/node/online");
+  std::string onlineList;
+  if (online && std::getline(online, onlineList)) {
+    for (int id : parseCpuList(onlineList)) {
+      std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+      std::string list;
+      if (!cpulist || !std::getline(cpulist, list)) continue;
+
+      Node node{id, {}};
+      for (int cpu : parseCpuList(list)) {
+        for (int a : allowed) {
+          if (a == cpu) node.cpus.push_back(cpu);
+        }
+      }
+      if (!node.cpus.empty()) nodes.push_back(node);
+    }
+  }
+
+  if (nodes.empty()) nodes.push_back({0, allowed});
+  return nodes;
+}
+
+// Restricts the calling thread to cpus
+inline void bindThread(const std::vector<int> &cpus)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)cpus;
+#endif
+}
+
+// Memory policy of the calling thread for pages it touches first from now
+// on: spread round-robin over nodes, or the default of the node the thread
+// runs on. Returns false where the policy cannot be set.
+inline bool interleaveMemory(const std::vector<Node> &nodes)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+  constexpr int kMpolInterleave = 3;
+  unsigned long mask = 0;
+  for (const auto &node : nodes) {
+    if (node.id < static_cast<int>(8 * sizeof(mask))) mask |= 1ul << node.id;
+  }
+  // the kernel reads one bit less than maxnode
+  return syscall(SYS_set_mempolicy, kMpolInterleave, &mask, 8 * sizeof(mask) + 1) == 0;
+#else
+  (void)nodes;
+  return false;
+#endif
+}
+
+inline bool localMemory()
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+  constexpr int kMpolDefault = 0;
+  return syscall(SYS_set_mempolicy, kMpolDefault, nullptr, 0) == 0;
+#else
+  return false;
+#endif
+}
+
+} // namespace Numa
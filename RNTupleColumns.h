@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <ROOT/RNTupleReader.hxx>
+#include <ROOT/RNTupleView.hxx>
+
+#include "ThreadPool.h"
+
+// Bulk, column-wise reading of top-level RNTuple fields, as opposed to
+// loading every entry with LoadEntry and appending to vectors.
+//
+// The destination is sized from the number of entries up front and each
+// requested column is read one cluster at a time with the bulk API
+// (RNTupleView::CreateBulk and RBulkValues::ReadBulk), so the values of a
+// whole cluster are unpacked in one call and copied straight into place.
+//
+// Clusters are independent, so they can also be read in parallel: every
+// thread of a ThreadPool opens its own reader and fills the entries of its
+// share of the clusters, each to its own place in the destination, so no
+// locking is needed and the entries stay in order.
+namespace RNTupleColumns {
+
+// Entries [firstEntry, firstEntry + nEntries) of the RNTuple, all in one cluster
+struct ClusterRange {
+  ROOT::DescriptorId_t clusterId;
+  std::uint64_t firstEntry;
+  std::uint64_t nEntries;
+};
+
+inline std::vector<ClusterRange> clusters(ROOT::RNTupleReader &reader)
+{
+  const auto &desc = reader.GetDescriptor();
+  std::vector<ClusterRange> ranges;
+  ranges.reserve(desc.GetNActiveClusters());
+
+  std::uint64_t entry = 0;
+  while (entry < reader.GetNEntries()) {
+    const auto clusterId = desc.FindClusterId(entry);
+    const auto &cluster = desc.GetClusterDescriptor(clusterId);
+    ranges.push_back({clusterId, cluster.GetFirstEntryIndex(), cluster.GetNEntries()});
+    entry = cluster.GetFirstEntryIndex() + cluster.GetNEntries();
+  }
+  return ranges;
+}
+
+// Splits ranges into nParts contiguous groups of roughly equal numbers of
+// entries, a cluster going to the part its first entry falls in
+inline std::vector<std::vector<ClusterRange>> partition(const std::vector<ClusterRange> &ranges, int nParts)
+{
+  std::uint64_t nEntries = 0;
+  for (const auto &range : ranges) nEntries = std::max(nEntries, range.firstEntry + range.nEntries);
+
+  std::vector<std::vector<ClusterRange>> parts(std::max(1, nParts));
+  for (const auto &range : ranges) {
+    const auto part = range.firstEntry * parts.size() / std::max<std::uint64_t>(1, nEntries);
+    parts[std::min<std::size_t>(part, parts.size() - 1)].push_back(range);
+  }
+  return parts;
+}
+
+// Consecutive clusters grouped into chunks of at most maxEntries entries,
+// except for clusters that are larger on their own
+inline std::vector<std::vector<ClusterRange>> group(const std::vector<ClusterRange> &ranges, std::uint64_t maxEntries)
+{
+  std::vector<std::vector<ClusterRange>> groups;
+  std::uint64_t entries = 0;
+  for (const auto &range : ranges) {
+    if (groups.empty() || entries + range.nEntries > maxEntries) {
+      groups.emplace_back();
+      entries = 0;
+    }
+    groups.back().push_back(range);
+    entries += range.nEntries;
+  }
+  return groups;
+}
+
+// Reads field for the entries of ranges into dest, which receives entry i at
+// dest[i - destFirstEntry]: by default it has room for all entries of the
+// RNTuple, or it only holds a chunk starting at destFirstEntry
+template <typename T>
+void read(ROOT::RNTupleReader &reader, const std::string &field, const std::vector<ClusterRange> &ranges, T *dest,
+          std::uint64_t destFirstEntry = 0)
+{
+  static_assert(std::is_arithmetic<T>::value, "RNTupleColumns only reads numeric fields");
+
+  auto view = reader.GetView<T>(field);
+  auto bulk = view.CreateBulk();
+
+  std::uint64_t maxEntries = 0;
+  for (const auto &range : ranges) maxEntries = std::max(maxEntries, range.nEntries);
+  std::unique_ptr<bool[]> mask(new bool[maxEntries]);
+  std::fill(mask.get(), mask.get() + maxEntries, true);
+
+  for (const auto &range : ranges) {
+    const auto *values = static_cast<const T *>(
+        bulk.ReadBulk(ROOT::RNTupleLocalIndex(range.clusterId, 0), mask.get(), range.nEntries));
+    std::memcpy(dest + (range.firstEntry - destFirstEntry), values, range.nEntries * sizeof(T));
+  }
+}
+
+template <typename T>
+std::vector<T> read(ROOT::RNTupleReader &reader, const std::string &field)
+{
+  std::vector<T> column(reader.GetNEntries());
+  read(reader, field, clusters(reader), column.data());
+  return column;
+}
+
+// Named float and int columns of an RNTuple
+struct Table {
+  std::uint64_t nEntries{0};
+  std::unordered_map<std::string, std::vector<float>> floats;
+  std::unordered_map<std::string, std::vector<std::int32_t>> ints;
+
+  const std::vector<float> &floatColumn(const std::string &name) const { return column(floats, name); }
+  const std::vector<std::int32_t> &intColumn(const std::string &name) const { return column(ints, name); }
+
+private:
+  template <typename Map>
+  static const typename Map::mapped_type &column(const Map &map, const std::string &name)
+  {
+    auto it = map.find(name);
+    if (it == map.end()) throw std::runtime_error("Column " + name + " was not read");
+    return it->second;
+  }
+};
+
+namespace detail {
+
+inline Table allocateTable(std::uint64_t nEntries, const std::vector<std::string> &floatFields,
+                           const std::vector<std::string> &intFields)
+{
+  Table table;
+  table.nEntries = nEntries;
+  for (const auto &field : floatFields) table.floats[field].resize(nEntries);
+  for (const auto &field : intFields) table.ints[field].resize(nEntries);
+  return table;
+}
+
+inline void readInto(ROOT::RNTupleReader &reader, const std::vector<ClusterRange> &ranges,
+                     const std::vector<std::string> &floatFields, const std::vector<std::string> &intFields,
+                     Table &table)
+{
+  for (const auto &field : floatFields) read(reader, field, ranges, table.floats.at(field).data());
+  for (const auto &field : intFields) read(reader, field, ranges, table.ints.at(field).data());
+}
+
+} // namespace detail
+
+inline Table readTable(const std::string &ntupleName, const std::string &fileName,
+                       const std::vector<std::string> &floatFields, const std::vector<std::string> &intFields = {})
+{
+  auto reader = ROOT::RNTupleReader::Open(ntupleName, fileName);
+  auto table = detail::allocateTable(reader->GetNEntries(), floatFields, intFields);
+  detail::readInto(*reader, clusters(*reader), floatFields, intFields, table);
+  return table;
+}
+
+// As above, with the clusters shared out between the threads of pool. Every
+// thread but the calling one opens the file again, so ROOT has to be thread
+// safe (ROOT::EnableThreadSafety or ROOT::EnableImplicitMT).
+inline Table readTable(const std::string &ntupleName, const std::string &fileName,
+                       const std::vector<std::string> &floatFields, const std::vector<std::string> &intFields,
+                       ThreadPool &pool)
+{
+  auto reader = ROOT::RNTupleReader::Open(ntupleName, fileName);
+  auto table = detail::allocateTable(reader->GetNEntries(), floatFields, intFields);
+  const auto parts = partition(clusters(*reader), pool.nThreads());
+
+  // the columns are only written from here on, never resized
+  pool.run([&](int thread) {
+    if (parts[thread].empty()) return;
+    if (thread == 0) {
+      detail::readInto(*reader, parts[thread], floatFields, intFields, table);
+    } else {
+      auto own = ROOT::RNTupleReader::Open(ntupleName, fileName);
+      detail::readInto(*own, parts[thread], floatFields, intFields, table);
+    }
+  });
+  return table;
+}
+
+} // namespace RNTupleColumns
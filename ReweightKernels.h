@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+
+// Event reweighting loops specialised at compile time on the number of
+// normalisation, functional and spline parameters and on the selection, so
+// that the compiler fully unrolls the per-event sums and products.
+//
+// For every selected event e in [begin, end) the kernels compute
+//
+//   shifted = x[e] + sum_i func[i] * funcVars[i][e]
+//   weight  = normWeight(normVar[e]) * prod_k splineFactors[k][splineIndex[k][e]]
+//
+// and call fill(e, shifted, weight). normWeight is 1 below normEdges[0] and
+// norm[i] from normEdges[i] on. The spline factors are looked up per event,
+// e.g. the per-bin factors of a FastSplineBank::State.
+//
+// reweight() dispatches to the instantiation matching the sizes in Inputs
+// when it is one of CommonConfigs, and to the generic one (all sizes Dynamic)
+// otherwise.
+namespace Reweight {
+
+constexpr int Dynamic = -1;
+
+struct Inputs {
+  std::size_t begin{0}, end{0};
+
+  const float *x{nullptr};
+  const float *const *funcVars{nullptr};
+  const float *func{nullptr};
+  int nFunc{0};
+
+  const float *normVar{nullptr};
+  const float *normEdges{nullptr};
+  const float *norm{nullptr};
+  int nNorm{0};
+
+  const int32_t *const *splineIndex{nullptr};
+  const float *const *splineFactors{nullptr};
+  int nSpline{0};
+};
+
+// Selection keeping every event, e.g. when all cuts were applied at load
+struct SelectAll {
+  bool operator()(std::size_t) const { return true; }
+};
+
+template <int NNorm>
+inline float normWeight(float var, const float *edges, const float *norm, int nNorm = NNorm)
+{
+  const int n = NNorm == Dynamic ? nNorm : NNorm;
+  float weight = 1.0f;
+  for (int i = 0; i < n; ++i) weight = var >= edges[i] ? norm[i] : weight;
+  return weight;
+}
+
+template <int NNorm, int NFunc, int NSpline, typename Selection, typename Fill>
+void kernel(const Inputs &in, Selection &&select, Fill &&fill)
+{
+  const int nNorm = NNorm == Dynamic ? in.nNorm : NNorm;
+  const int nFunc = NFunc == Dynamic ? in.nFunc : NFunc;
+  const int nSpline = NSpline == Dynamic ? in.nSpline : NSpline;
+
+  for (std::size_t e = in.begin; e < in.end; ++e) {
+    if (!select(e)) continue;
+
+    float shifted = in.x[e];
+    for (int i = 0; i < nFunc; ++i) shifted += in.func[i] * in.funcVars[i][e];
+
+    float weight = normWeight<NNorm>(in.normVar[e], in.normEdges, in.norm, nNorm);
+    for (int k = 0; k < nSpline; ++k) weight *= in.splineFactors[k][in.splineIndex[k][e]];
+
+    fill(e, shifted, weight);
+  }
+}
+
+template <int NNorm, int NFunc, int NSpline>
+struct Config {
+  static bool matches(const Inputs &in) { return in.nNorm == NNorm && in.nFunc == NFunc && in.nSpline == NSpline; }
+
+  template <typename Selection, typename Fill>
+  static void run(const Inputs &in, Selection &&select, Fill &&fill)
+  {
+    kernel<NNorm, NFunc, NSpline>(in, std::forward<Selection>(select), std::forward<Fill>(fill));
+  }
+};
+
+// The tutorial setup (3 Q2 normalisations, 2 terms in the energy shift, one
+// combined spline factor) and the same with parts of it switched off
+using CommonConfigs = std::tuple<Config<3, 2, 1>, Config<3, 2, 0>, Config<3, 0, 1>, Config<0, 2, 1>,
+                                 Config<0, 0, 1>, Config<3, 0, 0>>;
+
+template <typename... Configs>
+bool isSpecialised(const Inputs &in, std::tuple<Configs...> *)
+{
+  return (Configs::matches(in) || ...);
+}
+
+inline bool isSpecialised(const Inputs &in)
+{
+  return isSpecialised(in, static_cast<CommonConfigs *>(nullptr));
+}
+
+template <typename Selection, typename Fill, typename... Configs>
+void dispatch(const Inputs &in, Selection &select, Fill &fill, std::tuple<Configs...> *)
+{
+  const bool done = ((Configs::matches(in) && (Configs::run(in, select, fill), true)) || ...);
+  if (!done) kernel<Dynamic, Dynamic, Dynamic>(in, select, fill);
+}
+
+template <typename Selection, typename Fill>
+void reweight(const Inputs &in, Selection &&select, Fill &&fill)
+{
+  dispatch(in, select, fill, static_cast<CommonConfigs *>(nullptr));
+}
+
+// Callable multiplying N floats, with a signature RDataFrame can deduce the
+// column types from, e.g. Define("w", Product<101>(), columns) for a weight
+// built from 101 columns.
+template <std::size_t>
+using FloatArg = float;
+
+template <typename Indices>
+struct ProductImpl;
+
+template <std::size_t... I>
+struct ProductImpl<std::index_sequence<I...>> {
+  float operator()(FloatArg<I>... factors) const { return (... * factors); }
+};
+
+template <std::size_t N>
+using Product = ProductImpl<std::make_index_sequence<N>>;
+
+} // namespace Reweight
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// List of the samples of a fit, read from a plain text manifest:
+//
+//   # comment
+//   sample numu_FHC
+//     file    RNTuples/NuWro_numu_x_numu_FlatTree_Beam.root
+//     ntuple  Events
+//     splines BinnedSplinesTutorialInputs2D.root
+//     column  Enu_true Enu_true     # event store column, field of the RNTuple
+//     cut     Enu_true > 0
+//     cut     Enu_true < 4
+//
+// Every "sample" line starts a new sample, the keys after it apply to that
+// sample. Columns not listed are read from the field of the same name. Cuts
+// compare one column with a number (<, <=, >, >=, == or !=) and are static:
+// they are applied once, when the sample is loaded.
+namespace Samples {
+
+struct Cut {
+  enum class Op { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+
+  std::string column;
+  Op op;
+  float value;
+  std::string text; // as written in the manifest, e.g. "Enu_true < 4"
+
+  bool pass(float x) const
+  {
+    switch (op) {
+    case Op::Less: return x < value;
+    case Op::LessEqual: return x <= value;
+    case Op::Greater: return x > value;
+    case Op::GreaterEqual: return x >= value;
+    case Op::Equal: return x == value;
+    case Op::NotEqual: return x != value;
+    }
+    return false;
+  }
+};
+
+struct Sample {
+  std::string name;
+  std::string file;
+  std::string ntuple;
+  std::string splines;
+  std::map<std::string, std::string> columns; // event store column -> RNTuple field
+  std::vector<Cut> cuts;
+
+  const std::string &field(const std::string &column) const
+  {
+    auto it = columns.find(column);
+    return it == columns.end() ? column : it->second;
+  }
+};
+
+inline Cut parseCut(const std::string &column, const std::string &op, const std::string &value)
+{
+  static const std::map<std::string, Cut::Op> ops = {
+      {"<", Cut::Op::Less},          {"<=", Cut::Op::LessEqual}, {">", Cut::Op::Greater},
+      {">=", Cut::Op::GreaterEqual}, {"==", Cut::Op::Equal},     {"!=", Cut::Op::NotEqual}};
+  auto it = ops.find(op);
+  if (it == ops.end()) throw std::runtime_error("Unknown cut operator " + op);
+
+  std::size_t end = 0;
+  float number = 0;
+  try {
+    number = std::stof(value, &end);
+  } catch (const std::exception &) {
+  }
+  if (end == 0 || end != value.size()) throw std::runtime_error("Cut value " + value + " is not a number");
+  return {column, it->second, number, column + " " + op + " " + value};
+}
+
+inline std::vector<Sample> readManifest(const std::string &path)
+{
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("Cannot open " + path);
+
+  std::vector<Sample> samples;
+  std::string line;
+  for (int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream words(line);
+    std::vector<std::string> w;
+    for (std::string word; words >> word;) w.push_back(word);
+    if (w.empty()) continue;
+
+    auto fail = [&](const std::string &what) {
+      throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": " + what);
+    };
+    auto expect = [&](std::size_t n) {
+      if (w.size() != n) fail(w[0] + " takes " + std::to_string(n - 1) + " value(s)");
+    };
+
+    if (w[0] == "sample") {
+      expect(2);
+      samples.emplace_back();
+      samples.back().name = w[1];
+      continue;
+    }
+    if (samples.empty()) fail(w[0] + " before the first sample");
+    Sample &sample = samples.back();
+
+    if (w[0] == "file") {
+      expect(2);
+      sample.file = w[1];
+    } else if (w[0] == "ntuple") {
+      expect(2);
+      sample.ntuple = w[1];
+    } else if (w[0] == "splines") {
+      expect(2);
+      sample.splines = w[1];
+    } else if (w[0] == "column") {
+      expect(3);
+      sample.columns[w[1]] = w[2];
+    } else if (w[0] == "cut") {
+      expect(4);
+      try {
+        sample.cuts.push_back(parseCut(w[1], w[2], w[3]));
+      } catch (const std::exception &e) {
+        fail(e.what());
+      }
+    } else {
+      fail("unknown key " + w[0]);
+    }
+  }
+
+  for (const auto &sample : samples) {
+    if (sample.file.empty() || sample.ntuple.empty()) {
+      throw std::runtime_error(path + ": sample " + sample.name + " needs a file and an ntuple");
+    }
+  }
+  return samples;
+}
+
+} // namespace Samples
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Small dependency graph of tasks, built once and then run every step on the
+// threads of a ThreadPool.
+//
+// add(task, deps) adds a task that may only start once all tasks in deps have
+// finished; run() executes every task once. Each thread has its own deque of
+// ready tasks: it pushes the tasks its finished work made ready to the back
+// and takes its next task from the back as well, which keeps producer and
+// consumer on the same core, while idle threads steal from the front of the
+// other deques. This balances stages of uneven size (a large spline bank, a
+// small sample next to a big one) without having to partition them up front.
+//
+// Which thread runs a task is not deterministic, so tasks that produce
+// partial results (e.g. histograms of event chunks) should write them per
+// task and leave the reduction to a task depending on all of them.
+class TaskGraph {
+public:
+  using Task = std::function<void()>;
+
+  int add(Task task, const std::vector<int> &deps = {})
+  {
+    const int id = static_cast<int>(nodes_.size());
+    for (int dep : deps) {
+      if (dep < 0 || dep >= id) throw std::runtime_error("TaskGraph: a task can only depend on earlier tasks");
+      nodes_[dep].successors.push_back(id);
+    }
+    nodes_.push_back({std::move(task), {}, static_cast<int>(deps.size())});
+    return id;
+  }
+
+  int nTasks() const { return static_cast<int>(nodes_.size()); }
+
+  // Runs every task once, returns when all have finished. The first exception
+  // thrown by a task is rethrown once the running tasks have stopped.
+  void run(ThreadPool &pool)
+  {
+    const int n = nTasks();
+    // allocated by the first run, and again only if tasks were added or the
+    // pool changed since; later steps reset them in place
+    if (nRemaining_ != n) {
+      remaining_.reset(new std::atomic<int>[n]);
+      nRemaining_ = n;
+    }
+    for (int i = 0; i < n; ++i) remaining_[i].store(nodes_[i].nDeps, std::memory_order_relaxed);
+
+    if (static_cast<int>(queues_.size()) != pool.nThreads()) {
+      queues_.clear();
+      for (int thread = 0; thread < pool.nThreads(); ++thread) queues_.emplace_back(new Queue);
+    }
+    for (auto &q : queues_) q->tasks.clear(); // a failed run may have left tasks behind
+    int next = 0;
+    for (int i = 0; i < n; ++i) {
+      if (nodes_[i].nDeps == 0) queues_[next++ % queues_.size()]->tasks.push_back(i);
+    }
+
+    finished_.store(0, std::memory_order_relaxed);
+    failed_.store(false, std::memory_order_relaxed);
+    error_ = nullptr;
+
+    pool.run([this](int thread) { workerLoop(thread); });
+
+    if (error_) std::rethrow_exception(error_);
+  }
+
+private:
+  struct Node {
+    Task task;
+    std::vector<int> successors;
+    int nDeps;
+  };
+
+  struct alignas(64) Queue {
+    std::mutex mutex;
+    std::deque<int> tasks;
+  };
+
+  bool popOwn(int thread, int &task)
+  {
+    Queue &q = *queues_[thread];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) return false;
+    task = q.tasks.back();
+    q.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(int thread, int &task)
+  {
+    const int nQueues = static_cast<int>(queues_.size());
+    for (int i = 1; i < nQueues; ++i) {
+      Queue &q = *queues_[(thread + i) % nQueues];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.tasks.empty()) continue;
+      task = q.tasks.front();
+      q.tasks.pop_front();
+      return true;
+    }
+    return false;
+  }
+
+  void workerLoop(int thread)
+  {
+    const int n = nTasks();
+    while (finished_.load(std::memory_order_acquire) < n && !failed_.load(std::memory_order_relaxed)) {
+      int task;
+      if (!popOwn(thread, task) && !steal(thread, task)) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      try {
+        nodes_[task].task();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex_);
+        if (!error_) error_ = std::current_exception();
+        failed_.store(true, std::memory_order_relaxed);
+        return;
+      }
+
+      for (int successor : nodes_[task].successors) {
+        if (remaining_[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          Queue &q = *queues_[thread];
+          std::lock_guard<std::mutex> lock(q.mutex);
+          q.tasks.push_back(successor);
+        }
+      }
+      finished_.fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  std::vector<Node> nodes_;
+
+  std::unique_ptr<std::atomic<int>[]> remaining_; // unfinished dependencies per task
+  int nRemaining_{0};
+  std::vector<std::unique_ptr<Queue>> queues_;    // ready tasks, one deque per thread
+  std::atomic<int> finished_{0};
+  std::atomic<bool> failed_{false};
+  std::mutex errorMutex_;
+  std::exception_ptr error_;
+};
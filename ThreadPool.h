@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Persistent pool of worker threads for the per-step parallel loops. The
+// threads are started once and then wait for work, so a step does not pay for
+// creating threads.
+//
+// run(task) forks task(thread) onto every thread of the pool, thread 0 being
+// the calling thread, and joins once all have finished. The first exception
+// thrown by a task is rethrown by run(). parallelFor() splits a range into
+// one contiguous chunk per thread, always the same chunks for the same size
+// and number of threads, so thread-private results reduced in thread order
+// are reproducible bit for bit.
+//
+// Steps only take around a millisecond, so waking the workers through a
+// condition variable alone would cost a noticeable part of each step.
+// Instead, waiting threads (workers between steps, the caller in the join)
+// spin on an atomic for up to spin() before parking on a condition variable,
+// and forking only takes the lock to wake parked workers. Spinning is turned
+// off when there are more threads than CPUs to run them. Workers can be
+// pinned, worker i to the i-th CPU the process may run on, so they keep their
+// caches from one step to the next; the calling thread is left alone.
+//
+// Alternatively the pool can be given the exact CPU of every thread, e.g.
+// grouped by NUMA node. The calling thread is then pinned to the first one
+// for the lifetime of the pool and gets its previous affinity back after.
+class ThreadPool {
+public:
+  explicit ThreadPool(int nThreads = std::max(1u, std::thread::hardware_concurrency()), bool pinWorkers = true,
+                      std::chrono::microseconds spin = std::chrono::microseconds(200))
+    : nThreads_(std::max(1, nThreads)), spin_(spin)
+  {
+    const auto cpus = allowedCpus();
+    if (!cpus.empty() && nThreads_ > static_cast<int>(cpus.size())) spin_ = std::chrono::microseconds(0);
+
+    workers_.reserve(nThreads_ - 1);
+    for (int thread = 1; thread < nThreads_; ++thread) {
+      workers_.emplace_back([this, thread] { workerLoop(thread); });
+      if (pinWorkers && !cpus.empty()) pin(workers_.back().native_handle(), {cpus[thread % cpus.size()]});
+    }
+  }
+
+  // One thread per entry of threadCpus, thread i pinned to threadCpus[i]
+  explicit ThreadPool(const std::vector<int> &threadCpus,
+                      std::chrono::microseconds spin = std::chrono::microseconds(200))
+    : nThreads_(std::max<int>(1, threadCpus.size())), spin_(spin)
+  {
+    if (threadCpus.empty()) throw std::runtime_error("ThreadPool needs at least one CPU");
+    std::vector<int> distinct(threadCpus);
+    std::sort(distinct.begin(), distinct.end());
+    if (std::unique(distinct.begin(), distinct.end()) != distinct.end()) spin_ = std::chrono::microseconds(0);
+
+    callerCpus_ = allowedCpus();
+    pinCaller({threadCpus[0]});
+
+    workers_.reserve(nThreads_ - 1);
+    for (int thread = 1; thread < nThreads_; ++thread) {
+      workers_.emplace_back([this, thread] { workerLoop(thread); });
+      pin(workers_.back().native_handle(), {threadCpus[thread]});
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      generation_.fetch_add(1, std::memory_order_release);
+    }
+    wake_.notify_all();
+    for (auto &worker : workers_) worker.join();
+    if (!callerCpus_.empty()) pinCaller(callerCpus_);
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  int nThreads() const { return nThreads_; }
+  std::chrono::microseconds spin() const { return spin_; }
+
+  void run(const std::function<void(int)> &task)
+  {
+    task_ = &task;
+    error_ = nullptr;
+    pending_.store(nThreads_ - 1, std::memory_order_relaxed);
+
+    // fork
+    bool parked;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      generation_.fetch_add(1, std::memory_order_release);
+      parked = parkedWorkers_ > 0;
+    }
+    if (parked) wake_.notify_all();
+
+    runTask(0);
+
+    // join
+    if (!spinUntil([this] { return pending_.load(std::memory_order_acquire) == 0; })) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      callerParked_ = true;
+      done_.wait(lock, [this] { return pending_.load(std::memory_order_acquire) == 0; });
+      callerParked_ = false;
+    }
+
+    task_ = nullptr;
+    if (error_) std::rethrow_exception(error_);
+  }
+
+  // Chunk [begin, end) of n items for thread out of nThreads, the first
+  // n % nThreads chunks being one item longer
+  static std::pair<std::size_t, std::size_t> chunk(std::size_t n, int nThreads, int thread)
+  {
+    const std::size_t base = n / nThreads, extra = n % nThreads;
+    const std::size_t t = static_cast<std::size_t>(thread);
+    const std::size_t begin = t * base + std::min(t, extra);
+    return {begin, begin + base + (t < extra ? 1 : 0)};
+  }
+
+  // Calls f(thread, begin, end) for the chunk of [0, n) of every thread
+  template <typename F>
+  void parallelFor(std::size_t n, F &&f)
+  {
+    run([this, n, &f](int thread) {
+      const auto range = chunk(n, nThreads_, thread);
+      f(thread, range.first, range.second);
+    });
+  }
+
+private:
+  static void cpuRelax()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+  // Spins until done() or for spin_, returns whether done() became true
+  template <typename Done>
+  bool spinUntil(Done &&done) const
+  {
+    if (done()) return true;
+    if (spin_.count() == 0) return false;
+
+    const auto deadline = std::chrono::steady_clock::now() + spin_;
+    while (true) {
+      for (int i = 0; i < 64; ++i) {
+        if (done()) return true;
+        cpuRelax();
+      }
+      if (std::chrono::steady_clock::now() > deadline) return done();
+    }
+  }
+
+  void workerLoop(int thread)
+  {
+    uint64_t seen = 0;
+    while (true) {
+      auto changed = [this, &seen] { return generation_.load(std::memory_order_acquire) != seen; };
+      if (!spinUntil(changed)) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++parkedWorkers_;
+        wake_.wait(lock, changed);
+        --parkedWorkers_;
+      }
+      seen = generation_.load(std::memory_order_acquire);
+      if (stop_) return;
+
+      runTask(thread);
+
+      if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (callerParked_) done_.notify_one();
+      }
+    }
+  }
+
+  void runTask(int thread)
+  {
+    try {
+      (*task_)(thread);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) error_ = std::current_exception();
+    }
+  }
+
+  static std::vector<int> allowedCpus()
+  {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+      }
+    }
+#endif
+    return cpus;
+  }
+
+  static void pinCaller(const std::vector<int> &cpus)
+  {
+#ifdef __linux__
+    pin(pthread_self(), cpus);
+#else
+    (void)cpus;
+#endif
+  }
+
+  static void pin(std::thread::native_handle_type thread, const std::vector<int> &cpus)
+  {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+    (void)thread;
+    (void)cpus;
+#endif
+  }
+
+  const int nThreads_;
+  std::chrono::microseconds spin_;
+  std::vector<std::thread> workers_;
+  std::vector<int> callerCpus_; // affinity to give back to the caller, if it was pinned
+
+  // written by the caller before the fork, read by the workers after it
+  const std::function<void(int)> *task_{nullptr};
+  bool stop_{false};
+
+  alignas(64) std::atomic<uint64_t> generation_{0};
+  alignas(64) std::atomic<int> pending_{0};
+
+  std::mutex mutex_;
+  std::condition_variable wake_, done_;
+  int parkedWorkers_{0};
+  bool callerParked_{false};
+  std::exception_ptr error_;
+};
@@ -12,6 +12,8 @@
 #include <ROOT/RNTupleModel.hxx>
 #include <ROOT/RNTupleReader.hxx>
 
+#include "ReweightKernels.h"
+
 // this increases RDF's verbosity level as long as the `verbosity` variable is
 // in scope auto verbosity =
 // ROOT::RLogScopedVerbosity(ROOT::Detail::RDF::RDFLogChannel(),
@@ -73,6 +75,10 @@ ROOT::RDF::RNode create_rdf(const char *dataset_name,
                    {"Enu_true"}); // create RecoEnu columns as copy of Enu_true
 }
 
+// copies of the splines, which also fixes the number of columns evt_weight
+// multiplies: norm_weight and one spline weight per copy
+constexpr int n_spline_copies = 100;
+
 void run_rdf_charlotte_equivalent(
     ROOT::RDF::RNode df, const Params &params,
     const std::vector<std::vector<TSpline3 *>> &splines_copies,
@@ -117,111 +123,13 @@ void run_rdf_charlotte_equivalent(
                    {"Enu_true"});
   }
 
-  df = df.Define(
-      "evt_weight",
-      [](float norm_weight, float spline_weight_0, float spline_weight_1,
-         float spline_weight_2, float spline_weight_3, float spline_weight_4,
-         float spline_weight_5, float spline_weight_6, float spline_weight_7,
-         float spline_weight_8, float spline_weight_9, float spline_weight_10,
-         float spline_weight_11, float spline_weight_12, float spline_weight_13,
-         float spline_weight_14, float spline_weight_15, float spline_weight_16,
-         float spline_weight_17, float spline_weight_18, float spline_weight_19,
-         float spline_weight_20, float spline_weight_21, float spline_weight_22,
-         float spline_weight_23, float spline_weight_24, float spline_weight_25,
-         float spline_weight_26, float spline_weight_27, float spline_weight_28,
-         float spline_weight_29, float spline_weight_30, float spline_weight_31,
-         float spline_weight_32, float spline_weight_33, float spline_weight_34,
-         float spline_weight_35, float spline_weight_36, float spline_weight_37,
-         float spline_weight_38, float spline_weight_39, float spline_weight_40,
-         float spline_weight_41, float spline_weight_42, float spline_weight_43,
-         float spline_weight_44, float spline_weight_45, float spline_weight_46,
-         float spline_weight_47, float spline_weight_48, float spline_weight_49,
-         float spline_weight_50, float spline_weight_51, float spline_weight_52,
-         float spline_weight_53, float spline_weight_54, float spline_weight_55,
-         float spline_weight_56, float spline_weight_57, float spline_weight_58,
-         float spline_weight_59, float spline_weight_60, float spline_weight_61,
-         float spline_weight_62, float spline_weight_63, float spline_weight_64,
-         float spline_weight_65, float spline_weight_66, float spline_weight_67,
-         float spline_weight_68, float spline_weight_69, float spline_weight_70,
-         float spline_weight_71, float spline_weight_72, float spline_weight_73,
-         float spline_weight_74, float spline_weight_75, float spline_weight_76,
-         float spline_weight_77, float spline_weight_78, float spline_weight_79,
-         float spline_weight_80, float spline_weight_81, float spline_weight_82,
-         float spline_weight_83, float spline_weight_84, float spline_weight_85,
-         float spline_weight_86, float spline_weight_87, float spline_weight_88,
-         float spline_weight_89, float spline_weight_90, float spline_weight_91,
-         float spline_weight_92, float spline_weight_93, float spline_weight_94,
-         float spline_weight_95, float spline_weight_96, float spline_weight_97,
-         float spline_weight_98, float spline_weight_99) {
-        return norm_weight * spline_weight_0 * spline_weight_1 *
-               spline_weight_2 * spline_weight_3 * spline_weight_4 *
-               spline_weight_5 * spline_weight_6 * spline_weight_7 *
-               spline_weight_8 * spline_weight_9 * spline_weight_10 *
-               spline_weight_11 * spline_weight_12 * spline_weight_13 *
-               spline_weight_14 * spline_weight_15 * spline_weight_16 *
-               spline_weight_17 * spline_weight_18 * spline_weight_19 *
-               spline_weight_20 * spline_weight_21 * spline_weight_22 *
-               spline_weight_23 * spline_weight_24 * spline_weight_25 *
-               spline_weight_26 * spline_weight_27 * spline_weight_28 *
-               spline_weight_29 * spline_weight_30 * spline_weight_31 *
-               spline_weight_32 * spline_weight_33 * spline_weight_34 *
-               spline_weight_35 * spline_weight_36 * spline_weight_37 *
-               spline_weight_38 * spline_weight_39 * spline_weight_40 *
-               spline_weight_41 * spline_weight_42 * spline_weight_43 *
-               spline_weight_44 * spline_weight_45 * spline_weight_46 *
-               spline_weight_47 * spline_weight_48 * spline_weight_49 *
-               spline_weight_50 * spline_weight_51 * spline_weight_52 *
-               spline_weight_53 * spline_weight_54 * spline_weight_55 *
-               spline_weight_56 * spline_weight_57 * spline_weight_58 *
-               spline_weight_59 * spline_weight_60 * spline_weight_61 *
-               spline_weight_62 * spline_weight_63 * spline_weight_64 *
-               spline_weight_65 * spline_weight_66 * spline_weight_67 *
-               spline_weight_68 * spline_weight_69 * spline_weight_70 *
-               spline_weight_71 * spline_weight_72 * spline_weight_73 *
-               spline_weight_74 * spline_weight_75 * spline_weight_76 *
-               spline_weight_77 * spline_weight_78 * spline_weight_79 *
-               spline_weight_80 * spline_weight_81 * spline_weight_82 *
-               spline_weight_83 * spline_weight_84 * spline_weight_85 *
-               spline_weight_86 * spline_weight_87 * spline_weight_88 *
-               spline_weight_89 * spline_weight_90 * spline_weight_91 *
-               spline_weight_92 * spline_weight_93 * spline_weight_94 *
-               spline_weight_95 * spline_weight_96 * spline_weight_97 *
-               spline_weight_98 * spline_weight_99;
-      },
-      {"norm_weight",      "spline_weight_0",  "spline_weight_1",
-       "spline_weight_2",  "spline_weight_3",  "spline_weight_4",
-       "spline_weight_5",  "spline_weight_6",  "spline_weight_7",
-       "spline_weight_8",  "spline_weight_9",  "spline_weight_10",
-       "spline_weight_11", "spline_weight_12", "spline_weight_13",
-       "spline_weight_14", "spline_weight_15", "spline_weight_16",
-       "spline_weight_17", "spline_weight_18", "spline_weight_19",
-       "spline_weight_20", "spline_weight_21", "spline_weight_22",
-       "spline_weight_23", "spline_weight_24", "spline_weight_25",
-       "spline_weight_26", "spline_weight_27", "spline_weight_28",
-       "spline_weight_29", "spline_weight_30", "spline_weight_31",
-       "spline_weight_32", "spline_weight_33", "spline_weight_34",
-       "spline_weight_35", "spline_weight_36", "spline_weight_37",
-       "spline_weight_38", "spline_weight_39", "spline_weight_40",
-       "spline_weight_41", "spline_weight_42", "spline_weight_43",
-       "spline_weight_44", "spline_weight_45", "spline_weight_46",
-       "spline_weight_47", "spline_weight_48", "spline_weight_49",
-       "spline_weight_50", "spline_weight_51", "spline_weight_52",
-       "spline_weight_53", "spline_weight_54", "spline_weight_55",
-       "spline_weight_56", "spline_weight_57", "spline_weight_58",
-       "spline_weight_59", "spline_weight_60", "spline_weight_61",
-       "spline_weight_62", "spline_weight_63", "spline_weight_64",
-       "spline_weight_65", "spline_weight_66", "spline_weight_67",
-       "spline_weight_68", "spline_weight_69", "spline_weight_70",
-       "spline_weight_71", "spline_weight_72", "spline_weight_73",
-       "spline_weight_74", "spline_weight_75", "spline_weight_76",
-       "spline_weight_77", "spline_weight_78", "spline_weight_79",
-       "spline_weight_80", "spline_weight_81", "spline_weight_82",
-       "spline_weight_83", "spline_weight_84", "spline_weight_85",
-       "spline_weight_86", "spline_weight_87", "spline_weight_88",
-       "spline_weight_89", "spline_weight_90", "spline_weight_91",
-       "spline_weight_92", "spline_weight_93", "spline_weight_94",
-       "spline_weight_95", "spline_weight_96", "spline_weight_97",
-       "spline_weight_98", "spline_weight_99"});
+  // evt_weight is the product of norm_weight and all spline weights, with a
+  // generated functor taking one float per column
+  std::vector<std::string> weight_columns{"norm_weight"};
+  for (auto i = 0; i < splines_copies.size(); i++) {
+    weight_columns.push_back("spline_weight_" + std::to_string(i));
+  }
+  df = df.Define("evt_weight", Reweight::Product<n_spline_copies + 1>(), weight_columns);
 
   std::vector<float> bins = {0.,   0.5, 1.,   1.25, 1.5,  1.75, 2., 2.25, 2.5,
                              2.75, 3.,  3.25, 3.5,  3.75, 4.,   5., 6.,   10.};
@@ -390,7 +298,7 @@ int main() {
   // copy the splines so we can increase the running time/complexity
   // a real analysis will have O(100) splines
   std::vector<std::vector<TSpline3 *>> splines_copies;
-  for (int i = 0; i < 100; ++i) {
+  for (int i = 0; i < n_spline_copies; ++i) {
     std::vector<TSpline3 *> splines_copy;
     for (auto *s : splines) {
       splines_copy.push_back(static_cast<TSpline3 *>(s->Clone()));
@@ -12,6 +12,7 @@
 #include <ROOT/RNTupleModel.hxx>
 #include <ROOT/RNTupleReader.hxx>
 
+#include "EventSplineMap.h"
 #include "FastTSpline3Eval.h"
 
 // this increases RDF's verbosity level as long as the `verbosity` variable is
@@ -381,13 +382,17 @@ void run_vectors(const RNTupleData &data, const Params &params,
   }
 }
 
+// Splines are numbered i * nBins + bin across all copies, which is also how
+// spline_states and the EventSplineMap index them
 void run_vectors_fast(const RNTupleData &data, const Params &params,
                  const std::vector<std::vector<FastTSpline3Eval>> &fast_splines_copies,
-                 const std::vector<float> &bin_edges, const std::vector<std::vector<int>> &cached_bins) {
+                 std::vector<FastTSpline3Eval::State> &spline_states,
+                 const EventSplineMap &event_splines) {
 
+  size_t index = 0;
   for (const auto &splines : fast_splines_copies) {
     for (const auto &spline : splines) {
-      spline.Eval(params.spline_params[0]);
+      spline.Eval(params.spline_params[0], spline_states[index++]);
     }
   }
 
@@ -412,8 +417,6 @@ void run_vectors_fast(const RNTupleData &data, const Params &params,
   int nbins = bins.size() - 1;
   TH1D h{"hELep", "ELep;ELep [GeV];Events", nbins, bins.data()};
 
-  const int nSplines = fast_splines_copies[0].size();
-
   for (decltype(data.Enu_true.size()) entry = 0; entry < data.Enu_true.size();
        entry++) {
 
@@ -425,36 +428,32 @@ void run_vectors_fast(const RNTupleData &data, const Params &params,
       auto norm_weight = define_norm_weight(data.Q2[entry]);
 
       float evt_weight = norm_weight;
-      //for (const auto &splines : fast_splines_copies) {
-      for (int i = 0; i < nSplines; i++) {
-          evt_weight *= fast_splines_copies[i][cached_bins[entry][i]].GetCachedValue();
-      };
+      for (auto it = event_splines.begin(entry); it != event_splines.end(entry); ++it) {
+        evt_weight *= spline_states[*it].value;
+      }
       h.Fill(ELep_shift, evt_weight);
     }
   }
 }
 
-std::vector<std::vector<int>> get_cached_spline_bins(const RNTupleData &data,
+// Lists for every event the splines that apply to it: applies(entry, i)
+// decides whether spline systematic i reweights the event, and events outside
+// the spline binning get no splines (a weight of 1, as in run_vectors)
+template <typename Applies>
+EventSplineMap get_event_spline_map(const RNTupleData &data,
                  const std::vector<std::vector<FastTSpline3Eval>> &fast_splines_copies,
-                 const std::vector<float> &bin_edges) {
-  std::vector<std::vector<int>> cached_bins_per_entry;
-  cached_bins_per_entry.reserve(data.Enu_true.size());
-
-  for (decltype(data.Enu_true.size()) entry = 0; entry < data.Enu_true.size();
-       entry++) {
-
-    std::vector<int> cached_bins_for_entry;
-    cached_bins_for_entry.reserve(fast_splines_copies.size());
-
-    for (const auto &splines : fast_splines_copies) {
-      auto it = std::upper_bound(bin_edges.begin(), bin_edges.end(),
-                                     data.Enu_true[entry]);
-      int bin = std::distance(bin_edges.begin(), it) - 1;
-      cached_bins_for_entry.push_back(bin);
+                 const std::vector<float> &bin_edges, Applies &&applies) {
+  return EventSplineMap::build(data.Enu_true.size(), [&](size_t entry, std::vector<int32_t> &out) {
+    auto it = std::upper_bound(bin_edges.begin(), bin_edges.end(), data.Enu_true[entry]);
+    int bin = std::distance(bin_edges.begin(), it) - 1;
+
+    int index = 0;
+    for (size_t i = 0; i < fast_splines_copies.size(); i++) {
+      const int nBins = fast_splines_copies[i].size();
+      if (bin >= 0 && bin < nBins && applies(entry, i)) out.push_back(index + bin);
+      index += nBins;
     }
-    cached_bins_per_entry.push_back(cached_bins_for_entry);
-  }
-  return cached_bins_per_entry;
+  });
 }
 
 int main() {
@@ -487,6 +486,14 @@ int main() {
     fast_splines_copies.push_back(fast_splines_copy);
   }
 
+  // segment hints and cached values of the splines, kept apart so the splines
+  // themselves stay read-only
+  size_t n_fast_splines = 0;
+  for (const auto &fast_splines_copy : fast_splines_copies) {
+    n_fast_splines += fast_splines_copy.size();
+  }
+  std::vector<FastTSpline3Eval::State> spline_states(n_fast_splines);
+
   // number of times to loop over the graph with different parameters,
   // equivalent to number of faked MCMC steps
   int n_trials = 100;
@@ -519,12 +526,20 @@ int main() {
 
   // /// ---------
 
-  auto cached_bins = get_cached_spline_bins(rntuple_data, fast_splines_copies, spline_binning);
+  // as before the CSR map, only the first fast_splines_copies[0].size() copies
+  // (one per spline bin) reweight an event, so the results and timings stay
+  // comparable; a real sample would select on e.g. the interaction mode and
+  // target of the event
+  const size_t n_applied_copies = fast_splines_copies[0].size();
+  auto applies = [n_applied_copies](size_t, size_t syst) { return syst < n_applied_copies; };
+  auto event_splines = get_event_spline_map(rntuple_data, fast_splines_copies, spline_binning, applies);
+  std::cout << "Event spline map: " << event_splines.nEntries() << " entries, "
+            << event_splines.memoryBytes() / 1024.0 / 1024.0 << " MB" << std::endl;
 
   auto start_rntuple_fast = std::chrono::high_resolution_clock::now();
 
   for (const auto &params : random_params) {
-    run_vectors_fast(rntuple_data, params, fast_splines_copies, spline_binning, cached_bins);
+    run_vectors_fast(rntuple_data, params, fast_splines_copies, spline_states, event_splines);
   }
 
   auto end_rntuple_fast = std::chrono::high_resolution_clock::now();
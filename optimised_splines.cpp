@@ -8,11 +8,21 @@
 #include <TSpline.h>
 #include <TSystem.h>
 #include <chrono>
+#include <map>
 
-#include <ROOT/RNTupleModel.hxx>
 #include <ROOT/RNTupleReader.hxx>
 
-#include "FastTSpline3Eval.h"
+#include "BinaryFile.h"
+#include "ChunkStream.h"
+#include "CompactColumn.h"
+#include "FastHistogram1D.h"
+#include "FastSplineBank.h"
+#include "Numa.h"
+#include "RNTupleColumns.h"
+#include "SampleManifest.h"
+#include "ReweightKernels.h"
+#include "TaskGraph.h"
+#include "ThreadPool.h"
 
 struct Params {
   std::vector<float> func_params;
@@ -24,9 +34,44 @@ struct RNTupleData {
   std::vector<float> Enu_true{};
   std::vector<float> ELep{};
   std::vector<float> Q2{};
+
+  // histogram bin ELep_shift fell in at the previous step, checked first at
+  // the next one
+  std::vector<int32_t> ELep_shift_bin{};
+};
+
+// One event as read from disk, before any cut
+struct RNTupleEvent {
+  float Enu_true;
+  float ELep;
+  float Q2;
 };
 
-std::vector<Params> getRandomParams(int n, int n_spline_systs) {
+// A cut that depends on no fit parameter: one event column compared with a
+// number, as in the sample manifest. Static cuts are applied once when the
+// events are loaded and only the surviving events are kept, so neither the
+// vector loop nor the dataframe re-evaluates them every step. The event store
+// snapshot is keyed on the column, operator and value of every cut.
+struct StaticCut {
+  Samples::Cut cut;
+  float RNTupleEvent::*member;
+
+  const std::string &name() const { return cut.text; }
+  bool pass(const RNTupleEvent &event) const { return cut.pass(event.*member); }
+};
+
+// Static cut of the event store for a cut on one of its columns
+StaticCut static_cut(const Samples::Cut &cut) {
+  static const std::map<std::string, float RNTupleEvent::*> columns = {
+      {"Enu_true", &RNTupleEvent::Enu_true}, {"ELep", &RNTupleEvent::ELep}, {"Q2", &RNTupleEvent::Q2}};
+  auto it = columns.find(cut.column);
+  if (it == columns.end()) throw std::runtime_error("Cannot cut on " + cut.column + ", not an event store column");
+  return {cut, it->second};
+}
+
+// After the first set, only a block of n_changed spline parameters is redrawn
+// per set, mimicking block updates of an MCMC.
+std::vector<Params> getRandomParams(int n, int n_spline_systs, int n_changed) {
   TRandom3 rng;
   std::vector<Params> random_params;
   random_params.reserve(n);
@@ -37,9 +82,16 @@ std::vector<Params> getRandomParams(int n, int n_spline_systs) {
     params.norm_params = {static_cast<float>(rng.Gaus(1, 0.11)),
                           static_cast<float>(rng.Gaus(1, 0.18)),
                           static_cast<float>((rng.Gaus(1, 0.4)))};
-    params.spline_params.reserve(n_spline_systs);
-    for (int j = 0; j < n_spline_systs; ++j) {
-      params.spline_params.push_back(static_cast<float>(rng.Gaus(1, 0.3)));
+    if (i == 0 || n_changed >= n_spline_systs) {
+      params.spline_params.reserve(n_spline_systs);
+      for (int j = 0; j < n_spline_systs; ++j) {
+        params.spline_params.push_back(static_cast<float>(rng.Gaus(1, 0.3)));
+      }
+    } else {
+      params.spline_params = random_params.back().spline_params;
+      for (int j = 0; j < n_changed; ++j) {
+        params.spline_params[(i * n_changed + j) % n_spline_systs] = static_cast<float>(rng.Gaus(1, 0.3));
+      }
     }
     random_params.push_back(params);
   }
@@ -69,16 +121,53 @@ std::vector<std::vector<TSpline3 *>> getSplinesCopies(const std::vector<TSpline3
   return splines_copies;
 }
 
-std::vector<std::vector<FastTSpline3Eval>> getFastSplines(const std::vector<std::vector<TSpline3 *>> &splines_copies) {
-  std::vector<std::vector<FastTSpline3Eval>> fast_splines_copies;
-  for (const auto &splines_copy : splines_copies) {
-    std::vector<FastTSpline3Eval> fast_splines_copy;
-    for (auto *s : splines_copy) {
-      fast_splines_copy.push_back(FastTSpline3Eval(*s));
+// Name of copy i of the systematic whose splines are dev.mysyst1.ccqe.sp.N.0.0,
+// one per spline bin N
+std::string getSystName(int copy) { return "dev.mysyst1.ccqe." + std::to_string(copy); }
+
+std::vector<std::string> getSystNames(int n_copies) {
+  std::vector<std::string> names;
+  for (int i = 0; i < n_copies; ++i) names.push_back(getSystName(i));
+  return names;
+}
+
+FastSplineBank getFastSplines(const std::vector<std::vector<TSpline3 *>> &splines_copies,
+                              const FastSplineBank::Options &options) {
+  return FastSplineBank(splines_copies, options);
+}
+
+// Path, size and modification time of a file, which change whenever the file
+// is rewritten
+std::string fileStamp(const char *file) {
+  FileStat_t stat;
+  if (gSystem->GetPathInfo(file, stat) != 0) throw std::runtime_error(std::string("Cannot stat ") + file);
+  return std::string(file) + '\0' + std::to_string(stat.fSize) + '\0' + std::to_string(stat.fMtime) + '\0';
+}
+
+uint64_t splinesHash(const char *splines_file) {
+  const auto stamp = fileStamp(splines_file);
+  return BinaryFile::checksum(stamp.data(), stamp.size());
+}
+
+// Maps a previously saved spline bank, returning an empty bank if there is
+// none, it was built from another version of the spline file or with
+// different settings
+FastSplineBank loadFastSplines(const char *filename, const char *splines_file, int n_spline_systs,
+                               const FastSplineBank::Options &options) {
+  if (gSystem->AccessPathName(filename)) return FastSplineBank();
+  try {
+    auto fast_splines = FastSplineBank::load(filename);
+    if (fast_splines.sourceHash() == splinesHash(splines_file) && fast_splines.nSysts() == n_spline_systs &&
+        fast_splines.options().absTolerance == options.absTolerance &&
+        fast_splines.options().relTolerance == options.relTolerance &&
+        fast_splines.findSyst(getSystName(n_spline_systs - 1)) == n_spline_systs - 1) {
+      return fast_splines;
     }
-    fast_splines_copies.push_back(fast_splines_copy);
+    std::cout << filename << " is out of date, rebuilding it" << std::endl;
+  } catch (const std::exception &e) {
+    std::cout << e.what() << ", rebuilding it" << std::endl;
   }
-  return fast_splines_copies;
+  return FastSplineBank();
 }
 
 std::vector<float> getSplineBinning(char const *filename) {
@@ -92,9 +181,12 @@ std::vector<float> getSplineBinning(char const *filename) {
   return bins_edges;
 }
 
+// Spline bin of x, or the bin after the last one (FastSplineBank::outsideBin,
+// with a factor of 1) if x is outside the spline binning or nan
 int getSplineBin(float x, const std::vector<float> &bin_edges) {
   auto it = std::upper_bound(bin_edges.begin(), bin_edges.end(), x);
-  return std::distance(bin_edges.begin(), it) - 1;
+  const int bin = std::distance(bin_edges.begin(), it) - 1;
+  return bin < 0 ? static_cast<int>(bin_edges.size()) - 1 : bin;
 }
 
 std::vector<int> getSplineBins(const RNTupleData &data, const std::vector<float> &bin_edges) {
@@ -106,76 +198,343 @@ std::vector<int> getSplineBins(const RNTupleData &data, const std::vector<float>
   return bins;
 }
 
-void evaluateSplines(const std::vector<std::vector<FastTSpline3Eval>> &fast_splines, const Params &params) {
-  for (int i = 0; i < fast_splines.size(); i++) {
-    for (int j = 0; j < fast_splines[i].size(); j++) {
-      fast_splines[i][j].Eval(params.spline_params[i]);
+void evaluateSplines(const FastSplineBank &fast_splines, FastSplineBank::State &spline_state, const Params &params) {
+  // only the splines of parameters that changed since the last step
+  fast_splines.evaluateChanged(params.spline_params, spline_state);
+}
+
+void printSplineValues(const FastSplineBank &fast_splines, const FastSplineBank::State &spline_state){
+  for (int i = 0; i < fast_splines.nSysts(); i++) {
+    for (int j = 0; j < fast_splines.nBins(i); j++) {
+      std::cout << "Spline " << i << ", segment " << j << ", value: " << fast_splines.value(spline_state, i, j) << std::endl;
     }
   }
 }
 
-void printSplineValues(const std::vector<std::vector<FastTSpline3Eval>> &fast_splines){
-  for (int i = 0; i < fast_splines.size(); i++) {
-    for (int j = 0; j < fast_splines[i].size(); j++) {
-      std::cout << "Spline " << i << ", segment " << j << ", value: " << fast_splines[i][j].GetCachedValue() << std::endl;
-    }
+// Fills ELep_shift of events [begin, end) of the columns into h, with the
+// splines already evaluated for params
+void fill_ELep_shift(const float *Enu_true, const float *ELep, const float *Q2, const int *spline_bins,
+                     int32_t *ELep_shift_bin, const Params &params,
+                     const FastSplineBank::State &spline_state,
+                     FastHistogram1D &h, size_t begin, size_t end) {
+
+  const float norm_edges[] = {0.25, 0.5, 2.0};
+
+  // ELep_shift = RecoEnu + p[0] * ELep + p[1] * RecoEnu, with RecoEnu a copy
+  // of Enu_true as it is done in the RDF code, and a single spline factor per
+  // event: the product of all spline weights of its bin, computed once per
+  // step by evaluateSplines
+  const float *func_vars[] = {ELep, Enu_true};
+  const int32_t *spline_index[] = {spline_bins};
+  const float *spline_factors[] = {spline_state.binFactors.data()};
+
+  Reweight::Inputs inputs;
+  inputs.begin = begin;
+  inputs.end = end;
+  inputs.x = Enu_true;
+  inputs.funcVars = func_vars;
+  inputs.func = params.func_params.data();
+  inputs.nFunc = 2;
+  inputs.normVar = Q2;
+  inputs.normEdges = norm_edges;
+  inputs.norm = params.norm_params.data();
+  inputs.nNorm = params.norm_params.size();
+  inputs.splineIndex = spline_index;
+  inputs.splineFactors = spline_factors;
+  inputs.nSpline = 1;
+
+  // the static cuts were applied when loading the data
+  Reweight::reweight(inputs, Reweight::SelectAll(), [&h, ELep_shift_bin](size_t entry, float ELep_shift, float evt_weight) {
+    h.fill(ELep_shift, evt_weight, ELep_shift_bin[entry]);
+  });
+}
+
+void fill_ELep_shift(RNTupleData &data, const Params &params,
+                     const FastSplineBank::State &spline_state,
+                     const std::vector<int> &spline_bins,
+                     FastHistogram1D &h, size_t begin, size_t end) {
+  fill_ELep_shift(data.Enu_true.data(), data.ELep.data(), data.Q2.data(), spline_bins.data(),
+                  data.ELep_shift_bin.data(), params, spline_state, h, begin, end);
+}
+
+void run_vectors_fast(RNTupleData &data, const Params &params,
+                 const FastSplineBank &fast_splines,
+                 FastSplineBank::State &spline_state,
+                 const std::vector<int> &spline_bins,
+                 FastHistogram1D &h) {
+
+  evaluateSplines(fast_splines, spline_state, params);
+  //printSplineValues(fast_splines, spline_state);
+
+  // the histogram is reused from step to step
+  h.reset();
+  fill_ELep_shift(data, params, spline_state, spline_bins, h, 0, data.Enu_true.size());
+}
+
+// Same as run_vectors_fast with the events split into one contiguous chunk
+// per thread of the pool. Every thread fills its own histogram, which are
+// then added up in thread order, so the result is the same bit for bit at a
+// given number of threads.
+void run_vectors_parallel(RNTupleData &data, const Params &params,
+                 const FastSplineBank &fast_splines,
+                 FastSplineBank::State &spline_state,
+                 const std::vector<int> &spline_bins,
+                 ThreadPool &pool,
+                 std::vector<FastHistogram1D> &thread_hists,
+                 FastHistogram1D &h) {
+
+  evaluateSplines(fast_splines, spline_state, params);
+
+  pool.parallelFor(data.Enu_true.size(), [&](int thread, size_t begin, size_t end) {
+    thread_hists[thread].reset();
+    fill_ELep_shift(data, params, spline_state, spline_bins, thread_hists[thread], begin, end);
+  });
+
+  h.reset();
+  for (const auto &thread_hist : thread_hists) {
+    h.add(thread_hist);
   }
 }
 
-void run_vectors_fast(const RNTupleData &data, const Params &params,
-                 const std::vector<std::vector<FastTSpline3Eval>> &fast_splines,
-                 const std::vector<int> &spline_bins) {
+// Float columns of the events in reduced precision (see CompactColumn.h),
+// read by fill_ELep_shift_compact instead of those of the RNTupleData. The
+// ELep_shift bin cache and the spline bins are not compacted.
+struct CompactData {
+  Compact::Column Enu_true, ELep, Q2;
 
-  evaluateSplines(fast_splines, params);
-  //printSplineValues(fast_splines);
-  const int nSplines = fast_splines.size();
+  size_t memoryBytes() const { return Enu_true.memoryBytes() + ELep.memoryBytes() + Q2.memoryBytes(); }
+};
 
-  auto define_ELep_shift = [&params](float reco_enu, float e_lep) -> float {
-    const auto &p = params.func_params;
-    return reco_enu + p[0] * e_lep + p[1] * reco_enu;
-  };
+// Events are widened and reweighted in blocks small enough for the widened
+// columns to stay in L1
+constexpr size_t kCompactBlock = 512;
+
+void fill_ELep_shift_compact(const CompactData &compact, RNTupleData &data, const Params &params,
+                             const FastSplineBank::State &spline_state,
+                             const std::vector<int> &spline_bins,
+                             FastHistogram1D &h, size_t begin, size_t end, Compact::Kernel kernel) {
+  alignas(64) float Enu_true[kCompactBlock], ELep[kCompactBlock], Q2[kCompactBlock];
+  for (size_t block = begin; block < end; block += kCompactBlock) {
+    const size_t block_end = std::min(end, block + kCompactBlock);
+    fill_ELep_shift(compact.Enu_true.values(block, block_end, Enu_true, kernel),
+                    compact.ELep.values(block, block_end, ELep, kernel),
+                    compact.Q2.values(block, block_end, Q2, kernel), spline_bins.data() + block,
+                    data.ELep_shift_bin.data() + block, params, spline_state, h, 0, block_end - block);
+  }
+}
 
-  auto define_norm_weight = [&params](float q2) -> float {
-    if (q2 < 0.25)
-      return 1.0;
-    else if (q2 < 0.5)
-      return params.norm_params[0];
-    else if (q2 < 2.0)
-      return params.norm_params[1];
-    else
-      return params.norm_params[2];
-  };
+// Same as run_vectors_parallel, reading the compact columns
+void run_vectors_compact(const CompactData &compact, RNTupleData &data, const Params &params,
+                 const FastSplineBank &fast_splines,
+                 FastSplineBank::State &spline_state,
+                 const std::vector<int> &spline_bins,
+                 ThreadPool &pool,
+                 std::vector<FastHistogram1D> &thread_hists,
+                 FastHistogram1D &h, Compact::Kernel kernel) {
+
+  evaluateSplines(fast_splines, spline_state, params);
+
+  pool.parallelFor(data.Enu_true.size(), [&](int thread, size_t begin, size_t end) {
+    thread_hists[thread].reset();
+    fill_ELep_shift_compact(compact, data, params, spline_state, spline_bins, thread_hists[thread], begin, end,
+                            kernel);
+  });
+
+  h.reset();
+  for (const auto &thread_hist : thread_hists) {
+    h.add(thread_hist);
+  }
+}
 
-  std::vector<float> bins = {0.,   0.5, 1.,   1.25, 1.5,  1.75, 2., 2.25, 2.5,
-                             2.75, 3.,  3.25, 3.5,  3.75, 4.,   5., 6.,   10.};
-  int nbins = bins.size() - 1;
-  TH1D h{"hELep", "ELep;ELep [GeV];Events", nbins, bins.data()};
+// Prints what the compact columns cost in precision: the largest error of
+// every column and, for one set of params, how far the ELep_shift histogram
+// filled from them is from the one filled from the full precision columns
+void report_compact(const CompactData &compact, RNTupleData &data, const Params &params,
+                    const FastSplineBank &fast_splines,
+                    FastSplineBank::State &spline_state,
+                    const std::vector<int> &spline_bins,
+                    const FastHistogram1D &h_template, Compact::Kernel kernel) {
+  // the spline bins and the ELep_shift bin cache stay 32 bit either way
+  const size_t bin_bytes = spline_bins.size() * sizeof(int) + data.ELep_shift_bin.size() * sizeof(int32_t);
+  std::cout << "Compact columns (" << Compact::kernelName(kernel) << "): " << compact.memoryBytes() + bin_bytes
+            << " bytes, " << 3 * data.Enu_true.size() * sizeof(float) + bin_bytes << " in full precision, of which "
+            << bin_bytes << " in the 32 bit spline and ELep_shift bins" << std::endl;
+  const std::pair<const char *, const Compact::Column *> columns[] = {
+      {"Enu_true", &compact.Enu_true}, {"ELep", &compact.ELep}, {"Q2", &compact.Q2}};
+  for (const auto &column : columns) {
+    std::cout << "  " << column.first << ": " << Compact::formatName(column.second->encoding().format)
+              << ", max error " << column.second->maxError() << ", clipped " << column.second->clipped()
+              << std::endl;
+  }
+
+  evaluateSplines(fast_splines, spline_state, params);
+  FastHistogram1D h_full = h_template, h_compact = h_template;
+  h_full.reset();
+  h_compact.reset();
+  fill_ELep_shift(data, params, spline_state, spline_bins, h_full, 0, data.Enu_true.size());
+  fill_ELep_shift_compact(compact, data, params, spline_state, spline_bins, h_compact, 0, data.Enu_true.size(),
+                          kernel);
+
+  double max_rel_diff = 0, abs_diff = 0, abs_full = 0;
+  for (int bin = 0; bin <= h_full.nBins() + 1; ++bin) {
+    const double full = h_full.binContent(bin), diff = std::abs(h_compact.binContent(bin) - full);
+    if (full != 0) max_rel_diff = std::max(max_rel_diff, diff / std::abs(full));
+    abs_diff += diff;
+    abs_full += std::abs(full);
+  }
+  std::cout << "  histogram: largest bin difference " << 100 * max_rel_diff << "%, bin differences add up to "
+            << (abs_full ? 100 * abs_diff / abs_full : 0.0) << "% of the total, total "
+            << h_compact.sumOfWeights() << " vs " << h_full.sumOfWeights() << std::endl;
+}
 
-  for (decltype(data.Enu_true.size()) entry = 0; entry < data.Enu_true.size();
-       entry++) {
+// Events split into one shard per NUMA node, reweighted by the pool threads
+// of that node (threads first_thread to first_thread + n_threads - 1). Shards
+// get events in proportion to their number of threads.
+struct EventShard {
+  RNTupleData data;
+  std::vector<int> spline_bins;
+  int first_thread;
+  int n_threads;
+};
 
-    // create RecoEnu as copy of Enu_true as it is done in the RDF code
-    auto RecoEnu = data.Enu_true[entry];
+// Where the shards live in memory: each on its own node, first touched by a
+// thread of that node (Sharded), all first touched by a thread of the first
+// node (SingleNode, as when one thread loads everything), or spread page by
+// page over all nodes (Interleaved).
+enum class EventPlacement { Sharded, SingleNode, Interleaved };
+
+const char *placementName(EventPlacement placement) {
+  switch (placement) {
+  case EventPlacement::Sharded: return "sharded";
+  case EventPlacement::SingleNode: return "single node";
+  default: return "interleaved";
+  }
+}
 
-    if (data.Enu_true[entry] > 0 && data.Enu_true[entry] < 4) {
-      auto ELep_shift = define_ELep_shift(RecoEnu, data.ELep[entry]);
-      auto norm_weight = define_norm_weight(data.Q2[entry]);
+// thread_node[t] is the node (index into nodes) of thread t of pool, with the
+// threads of a node numbered consecutively
+std::vector<EventShard> make_event_shards(const RNTupleData &data, const std::vector<int> &spline_bins,
+                                          const std::vector<Numa::Node> &nodes,
+                                          const std::vector<int> &thread_node, ThreadPool &pool,
+                                          EventPlacement placement) {
+  std::vector<EventShard> shards(nodes.size());
+  std::vector<size_t> shard_begin(nodes.size() + 1, 0);
+  for (size_t node = 0; node < nodes.size(); ++node) {
+    auto &shard = shards[node];
+    shard.first_thread = std::find(thread_node.begin(), thread_node.end(), node) - thread_node.begin();
+    shard.n_threads = std::count(thread_node.begin(), thread_node.end(), node);
+    shard_begin[node + 1] = shard_begin[node] +
+        data.Enu_true.size() * shard.n_threads / thread_node.size();
+  }
+  shard_begin.back() = data.Enu_true.size();
+
+  auto fill_shard = [&](size_t node) {
+    const size_t begin = shard_begin[node], end = shard_begin[node + 1];
+    auto &shard = shards[node];
+    shard.data.Enu_true.assign(data.Enu_true.begin() + begin, data.Enu_true.begin() + end);
+    shard.data.ELep.assign(data.ELep.begin() + begin, data.ELep.begin() + end);
+    shard.data.Q2.assign(data.Q2.begin() + begin, data.Q2.begin() + end);
+    shard.data.ELep_shift_bin.assign(data.ELep_shift_bin.begin() + begin, data.ELep_shift_bin.begin() + end);
+    shard.spline_bins.assign(spline_bins.begin() + begin, spline_bins.begin() + end);
+  };
 
-      float evt_weight = norm_weight;
-      //for (const auto &splines : fast_splines_copies) {
-      for (int i = 0; i < nSplines; i++) {
-          evt_weight *= fast_splines[i][spline_bins[entry]].GetCachedValue();
-      };
-      //std::cout << "ELep_shift: " << ELep_shift << ", evt_weight: " << evt_weight << std::endl;
-      h.Fill(ELep_shift, evt_weight);
+  // the pages of a vector end up on the node of the thread writing them first
+  pool.run([&](int thread) {
+    if (placement == EventPlacement::Sharded) {
+      const size_t node = thread_node[thread];
+      if (thread == shards[node].first_thread) fill_shard(node);
+    } else if (thread == 0) {
+      if (placement == EventPlacement::Interleaved) Numa::interleaveMemory(nodes);
+      for (size_t node = 0; node < nodes.size(); ++node) fill_shard(node);
+      if (placement == EventPlacement::Interleaved) Numa::localMemory();
     }
+  });
+  return shards;
+}
+
+// Same as run_vectors_parallel, with every thread working on a chunk of the
+// shard of its own node
+void run_vectors_numa(std::vector<EventShard> &shards, const Params &params,
+                 const FastSplineBank &fast_splines,
+                 FastSplineBank::State &spline_state,
+                 const std::vector<int> &thread_node,
+                 ThreadPool &pool,
+                 std::vector<FastHistogram1D> &thread_hists,
+                 FastHistogram1D &h) {
+
+  evaluateSplines(fast_splines, spline_state, params);
+
+  pool.run([&](int thread) {
+    auto &shard = shards[thread_node[thread]];
+    const auto range = ThreadPool::chunk(shard.data.Enu_true.size(), shard.n_threads, thread - shard.first_thread);
+    thread_hists[thread].reset();
+    fill_ELep_shift(shard.data, params, spline_state, shard.spline_bins, thread_hists[thread], range.first,
+                    range.second);
+  });
+
+  h.reset();
+  for (const auto &thread_hist : thread_hists) {
+    h.add(thread_hist);
+  }
+}
+
+// A step as a graph of tasks: the spline evaluation in chunks of splines,
+// then the per-bin spline factors, then the events in chunks, each filling its
+// own histogram, and finally the sum of those histograms in chunk order, so
+// the result does not depend on which thread ran which chunk. The tasks read
+// the parameters through params, so the graph is built once and run every
+// step.
+struct StepGraph {
+  TaskGraph graph;
+  std::vector<FastHistogram1D> chunk_hists;
+};
+
+void build_step_graph(StepGraph &step, RNTupleData &data, const Params *params,
+                      const FastSplineBank &fast_splines,
+                      FastSplineBank::State &spline_state,
+                      const std::vector<int> &spline_bins,
+                      FastHistogram1D &h) {
+  const int splines_per_task = 1024;
+  const size_t events_per_task = 16384;
+
+  std::vector<int> spline_tasks;
+  for (int begin = 0; begin < fast_splines.nSplines(); begin += splines_per_task) {
+    const int end = std::min(begin + splines_per_task, fast_splines.nSplines());
+    spline_tasks.push_back(step.graph.add([&fast_splines, &spline_state, params, begin, end] {
+      fast_splines.evaluateRange(params->spline_params, spline_state, begin, end);
+    }));
   }
-  double total = h.GetMean();
-  //std::cout << total << std::endl; // Just to trigger the graph
+
+  const int bin_factor_task = step.graph.add([&fast_splines, &spline_state, params] {
+    fast_splines.updateBinFactors(spline_state, 0, fast_splines.nSplineBins());
+    fast_splines.markEvaluated(params->spline_params, spline_state);
+  }, spline_tasks);
+
+  const size_t n_events = data.Enu_true.size();
+  const size_t n_chunks = std::max<size_t>(1, (n_events + events_per_task - 1) / events_per_task);
+  step.chunk_hists.assign(n_chunks, h);
+
+  std::vector<int> event_tasks;
+  for (size_t chunk = 0; chunk < n_chunks; ++chunk) {
+    const size_t begin = chunk * events_per_task;
+    const size_t end = std::min(begin + events_per_task, n_events);
+    FastHistogram1D *chunk_hist = &step.chunk_hists[chunk];
+    event_tasks.push_back(step.graph.add([&data, &spline_state, &spline_bins, params, chunk_hist, begin, end] {
+      chunk_hist->reset();
+      fill_ELep_shift(data, *params, spline_state, spline_bins, *chunk_hist, begin, end);
+    }, {bin_factor_task}));
+  }
+
+  step.graph.add([&step, &h] {
+    h.reset();
+    for (const auto &chunk_hist : step.chunk_hists) {
+      h.add(chunk_hist);
+    }
+  }, event_tasks);
 }
 
 ROOT::RDF::RNode get_rw_df(ROOT::RDF::RNode df, const Params* params,
-             const std::vector<std::vector<FastTSpline3Eval>> &fast_splines,
+             const FastSplineBank::State *spline_state,
              const std::vector<float> &spline_binning) {
 
   df = df.Define("spline_bin", [&spline_binning](float Enu_true) -> int {
@@ -189,30 +548,16 @@ ROOT::RDF::RNode get_rw_df(ROOT::RDF::RNode df, const Params* params,
                  },
                  {"RecoEnu", "ELep"});
 
-  df = df.Filter([](float Enu_true) { return Enu_true > 0 && Enu_true < 4; },
-                 {"Enu_true"}, "Enu cut");
-
   df = df.Define("norm_weight",
                  [params](float Q2) -> float {
-                   if (Q2 < 0.25)
-                     return 1.0;
-                   else if (Q2 < 0.5)
-                     return params->norm_params[0];
-                   else if (Q2 < 2.0)
-                     return params->norm_params[1];
-                   else
-                     return params->norm_params[2];
+                   static const float norm_edges[] = {0.25, 0.5, 2.0};
+                   return Reweight::normWeight<3>(Q2, norm_edges, params->norm_params.data());
                  },
                  {"Q2"});
 
   df = df.Define("evt_weight",
-                 [fast_splines](float norm_weight, float TrueNeutrinoEnergy, int spline_bin) -> float {
-                   auto evt_weight = norm_weight;
-
-                   for (int i = 0; i < fast_splines.size(); i++) {
-                    evt_weight *= fast_splines[i][spline_bin].GetCachedValue();
-                   };
-                   return evt_weight;
+                 [spline_state](float norm_weight, float TrueNeutrinoEnergy, int spline_bin) -> float {
+                   return norm_weight * spline_state->binFactor(spline_bin);
                  },
                  {"norm_weight", "Enu_true", "spline_bin"});
 
@@ -220,9 +565,9 @@ ROOT::RDF::RNode get_rw_df(ROOT::RDF::RNode df, const Params* params,
 }
 
 void run_rdf_rw_fast(ROOT::RDF::RNode df_rw, 
-  const std::vector<std::vector<FastTSpline3Eval>> &fast_splines, const Params* params) {
+  const FastSplineBank &fast_splines, FastSplineBank::State &spline_state, const Params* params) {
 
-  evaluateSplines(fast_splines, *params);
+  evaluateSplines(fast_splines, spline_state, *params);
 
   std::vector<float> bins = {0.,   0.5, 1.,   1.25, 1.5,  1.75, 2., 2.25, 2.5,
                              2.75, 3.,  3.25, 3.5,  3.75, 4.,   5., 6.,   10.};
@@ -231,57 +576,380 @@ void run_rdf_rw_fast(ROOT::RDF::RNode df_rw,
       {"hELep", "ELep;ELep [GeV];Events", nbins, bins.data()}, "ELep_shift",
       "evt_weight");
 
-  double total = h->GetMean();
-  //std::cout << total << std::endl; // Just to trigger the graph
+  h->GetMean(); // Just to trigger the graph
+}
+
+// Keeps the events of data passing all static_cuts, compacted in place, and
+// adds the events removed by each cut to removed
+void apply_static_cuts(RNTupleData &data, const std::vector<StaticCut> &static_cuts, std::vector<size_t> &removed) {
+  size_t n_kept = 0;
+  for (size_t entry = 0; entry < data.Enu_true.size(); ++entry) {
+    const RNTupleEvent event{data.Enu_true[entry], data.ELep[entry], data.Q2[entry]};
+    bool pass = true;
+    for (size_t i = 0; i < static_cuts.size() && pass; ++i) {
+      pass = static_cuts[i].pass(event);
+      if (!pass) removed[i]++;
+    }
+    if (!pass) continue;
+
+    data.Enu_true[n_kept] = event.Enu_true;
+    data.ELep[n_kept] = event.ELep;
+    data.Q2[n_kept] = event.Q2;
+    n_kept++;
+  }
+  data.Enu_true.resize(n_kept);
+  data.ELep.resize(n_kept);
+  data.Q2.resize(n_kept);
+  data.ELep_shift_bin.assign(n_kept, 0);
 }
 
 RNTupleData create_rntuple_data(const char *dataset_name,
-                                const char *dataset_file) {
-  // Create an RNTupleModel with the only three columns that will be read from
-  // disk
-  auto model = ROOT::RNTupleModel::Create();
-  auto Enu_true = model->MakeField<float>("Enu_true");
-  auto ELep = model->MakeField<float>("ELep");
-  auto Q2 = model->MakeField<float>("Q2");
-
-  // Open the file with the RNTuple, applying the model previously defined
-  auto reader =
-      ROOT::RNTupleReader::Open(std::move(model), dataset_name, dataset_file);
+                                const char *dataset_file,
+                                const std::vector<StaticCut> &static_cuts,
+                                ThreadPool &pool) {
+  // Read the only three columns needed, in bulk and cluster by cluster with
+  // the clusters shared out over the pool, straight into the event store
+  auto table = RNTupleColumns::readTable(dataset_name, dataset_file, {"Enu_true", "ELep", "Q2"}, {}, pool);
 
   RNTupleData ret;
+  ret.Enu_true = std::move(table.floats["Enu_true"]);
+  ret.ELep = std::move(table.floats["ELep"]);
+  ret.Q2 = std::move(table.floats["Q2"]);
+
+  // events removed by each cut, in order, out of those passing the previous ones
+  std::vector<size_t> removed(static_cuts.size(), 0);
+  const size_t n_read = ret.Enu_true.size();
+  apply_static_cuts(ret, static_cuts, removed);
+
+  std::cout << "Static cuts: " << n_read << " events read" << std::endl;
+  for (size_t i = 0; i < static_cuts.size(); ++i) {
+    std::cout << "  " << static_cuts[i].name() << ": removed " << removed[i] << " ("
+              << (n_read ? 100.0 * removed[i] / n_read : 0.0) << "%)" << std::endl;
+  }
+  std::cout << "  kept " << ret.Enu_true.size() << " ("
+            << (n_read ? 100.0 * ret.Enu_true.size() / n_read : 0.0) << "%)" << std::endl;
+
+  return ret;
+}
+
+// Snapshot of the prepared event store: the columns after the static cuts and
+// the spline bin of every event, in a BinaryFile. It records a hash of all it
+// was made from and is only used while that hash still matches.
+constexpr const char *kEventStoreMagic = "MACH3EVT";
+constexpr uint32_t kEventStoreVersion = 2;
+
+// Hash of the event store inputs: the RNTuple and spline files (path, size
+// and modification time), the spline binning and the static cuts
+uint64_t eventStoreHash(const char *dataset_name, const char *dataset_file, const char *splines_file,
+                        const std::vector<float> &spline_binning, const std::vector<StaticCut> &static_cuts) {
+  std::string key = std::string(dataset_name) + '\0';
+  for (const char *file : {dataset_file, splines_file}) key += fileStamp(file);
+  key.append(reinterpret_cast<const char *>(spline_binning.data()), spline_binning.size() * sizeof(float));
+  for (const auto &static_cut : static_cuts) {
+    const auto &cut = static_cut.cut;
+    const auto op = static_cast<int32_t>(cut.op);
+    key += cut.column + '\0';
+    key.append(reinterpret_cast<const char *>(&op), sizeof(op));
+    key.append(reinterpret_cast<const char *>(&cut.value), sizeof(cut.value));
+  }
+  return BinaryFile::checksum(key.data(), key.size());
+}
 
-  int counter = 0;
+void saveEventStore(const char *filename, uint64_t hash, const RNTupleData &data,
+                    const std::vector<int> &spline_bins) {
+  BinaryFile::Writer writer(kEventStoreMagic, kEventStoreVersion);
+  writer.add("hash", &hash, sizeof(hash));
+  writer.add("Enu_true", data.Enu_true);
+  writer.add("ELep", data.ELep);
+  writer.add("Q2", data.Q2);
+  writer.add("spline_bins", spline_bins);
+  writer.write(filename);
+}
+
+// Maps the snapshot, returns nullptr if there is no usable snapshot for hash
+std::shared_ptr<BinaryFile::Reader> openEventStore(const char *filename, uint64_t hash) {
+  if (gSystem->AccessPathName(filename)) return nullptr;
+  try {
+    auto reader = std::make_shared<BinaryFile::Reader>(filename, kEventStoreMagic, kEventStoreVersion);
+    if (reader->scalar<uint64_t>("hash") != hash) {
+      std::cout << filename << " is out of date, rebuilding it" << std::endl;
+      return nullptr;
+    }
+    std::size_t n_events, count;
+    reader->section<float>("Enu_true", n_events);
+    for (const char *name : {"ELep", "Q2"}) {
+      reader->section<float>(name, count);
+      if (count != n_events) throw std::runtime_error(std::string(filename) + " has columns of different lengths");
+    }
+    reader->section<int>("spline_bins", count);
+    if (count != n_events) throw std::runtime_error(std::string(filename) + " has columns of different lengths");
+    return reader;
+  } catch (const std::exception &e) {
+    std::cout << e.what() << ", rebuilding it" << std::endl;
+  }
+  return nullptr;
+}
+
+size_t eventStoreSize(const BinaryFile::Reader &reader) {
+  std::size_t n_events;
+  reader.section<float>("Enu_true", n_events);
+  return n_events;
+}
+
+// Copies events [begin, end) of the snapshot into data and spline_bins. The
+// columns are copied out of the read-only mapping because the event store
+// owns (and may shard) them.
+void copyEventStore(const BinaryFile::Reader &reader, size_t begin, size_t end, RNTupleData &data,
+                    std::vector<int> &spline_bins) {
+  auto column = [&reader, begin, end](const char *name, auto &out) {
+    using T = typename std::decay_t<decltype(out)>::value_type;
+    std::size_t count;
+    const T *values = reader.section<T>(name, count);
+    out.assign(values + begin, values + end);
+  };
+  column("Enu_true", data.Enu_true);
+  column("ELep", data.ELep);
+  column("Q2", data.Q2);
+  column("spline_bins", spline_bins);
+  data.ELep_shift_bin.assign(end - begin, 0);
+}
+
+// Fills data and spline_bins from the snapshot, returns false if there is no
+// usable snapshot for hash
+bool loadEventStore(const char *filename, uint64_t hash, RNTupleData &data, std::vector<int> &spline_bins) {
+  auto reader = openEventStore(filename, hash);
+  if (!reader) return false;
+  copyEventStore(*reader, 0, eventStoreSize(*reader), data, spline_bins);
+  return true;
+}
+
+// Out-of-core mode, for event stores that do not fit in memory: the events
+// are streamed in chunks through two buffers, the next chunk being read in
+// the background while the current one is reweighted (see ChunkStream.h).
+struct EventChunk {
+  RNTupleData data;
+  std::vector<int> spline_bins;
+};
+using EventStream = ChunkStream<EventChunk>;
 
-  for (auto entryId : *reader) {
-    reader->LoadEntry(entryId);
+// Events per chunk such that the two buffers fit in memory_budget bytes
+size_t chunkEvents(size_t memory_budget) {
+  const size_t bytes_per_event = 3 * sizeof(float) + sizeof(int32_t) + sizeof(int);
+  return std::max<size_t>(1, memory_budget / (2 * bytes_per_event));
+}
+
+// Streams the events of the snapshot, nullptr if there is no usable one
+std::unique_ptr<EventStream> stream_event_store(const char *filename, uint64_t hash, size_t memory_budget) {
+  auto reader = openEventStore(filename, hash);
+  if (!reader) return nullptr;
+  const size_t n_events = eventStoreSize(*reader);
+  const size_t chunk_events = chunkEvents(memory_budget);
+  const size_t n_chunks = std::max<size_t>(1, (n_events + chunk_events - 1) / chunk_events);
+  return std::make_unique<EventStream>(n_chunks, [reader, n_events, chunk_events](size_t chunk, EventChunk &buffer) {
+    const size_t begin = chunk * chunk_events;
+    copyEventStore(*reader, begin, std::min(n_events, begin + chunk_events), buffer.data, buffer.spline_bins);
+  });
+}
 
-    ret.Enu_true.push_back(*Enu_true);
-    ret.ELep.push_back(*ELep);
-    ret.Q2.push_back(*Q2);
+// Streams the events of the RNTuple, applying the static cuts and finding the
+// spline bins chunk by chunk. Chunks are whole clusters, so a cluster larger
+// than the memory budget allows is still read at once.
+std::unique_ptr<EventStream> stream_rntuple(const char *dataset_name, const char *dataset_file,
+                                            const std::vector<StaticCut> &static_cuts,
+                                            const std::vector<float> &spline_binning, size_t memory_budget) {
+  // only ever used by the thread loading the chunks
+  std::shared_ptr<ROOT::RNTupleReader> reader = ROOT::RNTupleReader::Open(dataset_name, dataset_file);
+  auto groups = RNTupleColumns::group(RNTupleColumns::clusters(*reader), chunkEvents(memory_budget));
+  if (groups.empty()) groups.emplace_back();
+  const size_t n_chunks = groups.size();
+  return std::make_unique<EventStream>(
+      n_chunks, [reader, groups, static_cuts, spline_binning](size_t chunk, EventChunk &buffer) {
+        const auto &ranges = groups[chunk];
+        const uint64_t first = ranges.empty() ? 0 : ranges.front().firstEntry;
+        const uint64_t n_entries = ranges.empty() ? 0 : ranges.back().firstEntry + ranges.back().nEntries - first;
+        buffer.data.Enu_true.resize(n_entries);
+        buffer.data.ELep.resize(n_entries);
+        buffer.data.Q2.resize(n_entries);
+        RNTupleColumns::read(*reader, "Enu_true", ranges, buffer.data.Enu_true.data(), first);
+        RNTupleColumns::read(*reader, "ELep", ranges, buffer.data.ELep.data(), first);
+        RNTupleColumns::read(*reader, "Q2", ranges, buffer.data.Q2.data(), first);
+
+        std::vector<size_t> removed(static_cuts.size(), 0);
+        apply_static_cuts(buffer.data, static_cuts, removed);
+        buffer.spline_bins = getSplineBins(buffer.data, spline_binning);
+      });
+}
 
-    counter ++;
-    //if (counter > 10)     break;
+// Same as run_vectors_parallel with the events streamed in chunks. Chunks
+// only stay in memory from one step to the next if there are at most two, so
+// the ELep_shift bin cache otherwise starts afresh with every chunk.
+void run_vectors_streaming(EventStream &stream, const Params &params,
+                 const FastSplineBank &fast_splines,
+                 FastSplineBank::State &spline_state,
+                 ThreadPool &pool,
+                 std::vector<FastHistogram1D> &thread_hists,
+                 FastHistogram1D &h) {
+
+  evaluateSplines(fast_splines, spline_state, params);
+
+  for (auto &thread_hist : thread_hists) thread_hist.reset();
+  stream.forEach([&](size_t, EventChunk &chunk) {
+    pool.parallelFor(chunk.data.Enu_true.size(), [&](int thread, size_t begin, size_t end) {
+      fill_ELep_shift(chunk.data, params, spline_state, chunk.spline_bins, thread_hists[thread], begin, end);
+    });
+  });
+
+  h.reset();
+  for (const auto &thread_hist : thread_hists) {
+    h.add(thread_hist);
   }
+}
 
-  return ret;
+// All samples of a manifest in one event store, each sample in a contiguous
+// range of events, in manifest order
+struct SampleRange {
+  std::string name;
+  size_t begin;
+  size_t end;
+};
+
+struct MultiSampleStore {
+  RNTupleData data;
+  std::vector<int> spline_bins;
+  std::vector<SampleRange> samples;
+};
+
+// Loads the samples and then copies them into place in one store. With at
+// least as many samples as threads, every thread of the pool takes the next
+// sample not yet loaded; with fewer, the samples are read one after another,
+// each with its clusters shared out over the pool, so no thread sits idle.
+MultiSampleStore load_samples(const std::vector<Samples::Sample> &samples, const std::vector<float> &spline_binning,
+                              ThreadPool &pool) {
+  const size_t n_samples = samples.size();
+  std::vector<RNTupleData> sample_data(n_samples);
+  std::vector<std::vector<int>> sample_bins(n_samples);
+  std::vector<size_t> n_read(n_samples);
+
+  auto fields = [](const Samples::Sample &sample) {
+    return std::vector<std::string>{sample.field("Enu_true"), sample.field("ELep"), sample.field("Q2")};
+  };
+  // cuts and spline bins of sample i, read into table
+  auto prepare = [&](size_t i, RNTupleColumns::Table &table) {
+    const auto &sample = samples[i];
+    auto &data = sample_data[i];
+    data.Enu_true = std::move(table.floats[sample.field("Enu_true")]);
+    data.ELep = std::move(table.floats[sample.field("ELep")]);
+    data.Q2 = std::move(table.floats[sample.field("Q2")]);
+    n_read[i] = data.Enu_true.size();
+
+    std::vector<StaticCut> static_cuts;
+    for (const auto &cut : sample.cuts) static_cuts.push_back(static_cut(cut));
+    std::vector<size_t> removed(static_cuts.size(), 0);
+    apply_static_cuts(data, static_cuts, removed);
+    sample_bins[i] = getSplineBins(data, spline_binning);
+  };
+
+  std::atomic<size_t> next_sample{0};
+  if (n_samples < static_cast<size_t>(pool.nThreads())) {
+    for (size_t i = 0; i < n_samples; ++i) {
+      auto table = RNTupleColumns::readTable(samples[i].ntuple, samples[i].file, fields(samples[i]), {}, pool);
+      prepare(i, table);
+    }
+  } else {
+    pool.run([&](int) {
+      for (size_t i; (i = next_sample.fetch_add(1)) < n_samples;) {
+        auto table = RNTupleColumns::readTable(samples[i].ntuple, samples[i].file, fields(samples[i]));
+        prepare(i, table);
+      }
+    });
+  }
+
+  MultiSampleStore store;
+  size_t n_events = 0;
+  for (size_t i = 0; i < n_samples; ++i) {
+    const size_t n = sample_data[i].Enu_true.size();
+    store.samples.push_back({samples[i].name, n_events, n_events + n});
+    n_events += n;
+    std::cout << "Sample " << samples[i].name << ": kept " << n << " of " << n_read[i] << " events" << std::endl;
+  }
+
+  store.data.Enu_true.resize(n_events);
+  store.data.ELep.resize(n_events);
+  store.data.Q2.resize(n_events);
+  store.data.ELep_shift_bin.assign(n_events, 0);
+  store.spline_bins.resize(n_events);
+
+  next_sample.store(0);
+  pool.run([&](int) {
+    for (size_t i; (i = next_sample.fetch_add(1)) < n_samples;) {
+      const auto &data = sample_data[i];
+      const size_t begin = store.samples[i].begin;
+      std::copy(data.Enu_true.begin(), data.Enu_true.end(), store.data.Enu_true.begin() + begin);
+      std::copy(data.ELep.begin(), data.ELep.end(), store.data.ELep.begin() + begin);
+      std::copy(data.Q2.begin(), data.Q2.end(), store.data.Q2.begin() + begin);
+      std::copy(sample_bins[i].begin(), sample_bins[i].end(), store.spline_bins.begin() + begin);
+    }
+  });
+
+  return store;
+}
+
+// Same as run_vectors_parallel over the store of all samples, filling one
+// histogram per sample. The events are split into one chunk per thread
+// regardless of the samples, and every thread fills the histograms of the
+// samples its chunk overlaps, thread_hists[thread][sample].
+void run_vectors_samples(MultiSampleStore &store, const Params &params,
+                 const FastSplineBank &fast_splines,
+                 FastSplineBank::State &spline_state,
+                 ThreadPool &pool,
+                 std::vector<std::vector<FastHistogram1D>> &thread_hists,
+                 std::vector<FastHistogram1D> &sample_hists) {
+
+  evaluateSplines(fast_splines, spline_state, params);
+
+  pool.parallelFor(store.data.Enu_true.size(), [&](int thread, size_t begin, size_t end) {
+    for (size_t sample = 0; sample < store.samples.size(); ++sample) {
+      auto &h = thread_hists[thread][sample];
+      h.reset();
+      const size_t sample_begin = std::max(begin, store.samples[sample].begin);
+      const size_t sample_end = std::min(end, store.samples[sample].end);
+      if (sample_begin < sample_end) {
+        fill_ELep_shift(store.data, params, spline_state, store.spline_bins, h, sample_begin, sample_end);
+      }
+    }
+  });
+
+  for (size_t sample = 0; sample < sample_hists.size(); ++sample) {
+    sample_hists[sample].reset();
+    for (const auto &hists : thread_hists) {
+      sample_hists[sample].add(hists[sample]);
+    }
+  }
 }
 
 ROOT::RDF::RNode create_rdf(const char *dataset_name,
-                            const char *dataset_file) {
+                            const char *dataset_file,
+                            const std::vector<StaticCut> &static_cuts) {
 
   const std::vector<std::string> cache_columns{"Enu_true", "ELep", "Q2"};
   ROOT::RDataFrame root{dataset_name, dataset_file};
-  ROOT::RDF::RNode df = root.Cache<float, float, float>(cache_columns);
+  ROOT::RDF::RNode df = root;
+  // filter before caching, so only the surviving events are cached
+  for (const auto &cut : static_cuts) {
+    df = df.Filter([cut](float Enu_true, float ELep, float Q2) { return cut.pass({Enu_true, ELep, Q2}); },
+                   cache_columns, cut.name());
+  }
+  df = df.Cache<float, float, float>(cache_columns);
   return df.Define("RecoEnu", [](float Enu_true) -> float { return Enu_true; },
                    {"Enu_true"}); // create RecoEnu columns as copy of Enu_true
 }
 
-void checkSplines(const std::vector<std::vector<FastTSpline3Eval>> &fast_splines_copies, const std::vector<std::vector<TSpline3 *>> &splines_copies) {
+void checkSplines(const FastSplineBank &fast_splines_copies, const std::vector<std::vector<TSpline3 *>> &splines_copies) {
   for (size_t i = 0; i < splines_copies.size(); ++i) {
     for (size_t j = 0; j < splines_copies[i].size(); ++j) {
       std::vector<float> test_xs = {0.1f, 0.5f, 1.0f, 1.5f, 2.0f}; // Add more test points as needed
       for (const auto &x : test_xs) {
-        float y_fast = fast_splines_copies[i][j].Eval(x);
+        float y_fast = fast_splines_copies.evalSlot(i, j, x);
         float y_slow = splines_copies[i][j]->Eval(x);
         if (std::abs(y_fast - y_slow) > 1e-5) {
           std::cerr << "Mismatch in spline evaluation at spline " << i << ", segment " << j
@@ -299,34 +967,118 @@ int main() {
   auto dataset_file = "RNTuples/NuWro_numu_x_numu_FlatTree_Beam.root";
   auto splines_file = "BinnedSplinesTutorialInputs2D.root";
 
-  int n_spline_systs = 1000;
+  // binary copy of the spline bank, written on the first run and mapped
+  // straight back in on later runs
+  auto spline_bank_file = "BinnedSplinesTutorialInputs2D.splinebank";
+  // and of the events after the static cuts, with their spline bins
+  auto event_store_file = "NuWro_numu_x_numu_FlatTree_Beam.eventstore";
+  // samples of the multi-sample store
+  auto manifest_file = "samples.manifest";
 
-  auto splines = getSplines(splines_file);
-  auto spline_binning = getSplineBinning(splines_file);
-  auto splines_copies = getSplinesCopies(splines, n_spline_systs);
-  auto fast_splines = getFastSplines(splines_copies);
+  int n_spline_systs = 1000;
+  // number of spline parameters changed per step, as in a block update of an
+  // MCMC; n_spline_systs changes all of them
+  int n_changed_spline_params = 10;
+
+  // error budget for dropping cubic/quadratic terms of the splines, 0 keeps
+  // them exact
+  FastSplineBank::Options spline_options;
+  spline_options.absTolerance = 0;
+  spline_options.relTolerance = 0;
+
+  auto start_splines = std::chrono::high_resolution_clock::now();
+  auto fast_splines = loadFastSplines(spline_bank_file, splines_file, n_spline_systs, spline_options);
+  if (fast_splines.nSysts() == 0) {
+    auto splines = getSplines(splines_file);
+    auto splines_copies = getSplinesCopies(splines, n_spline_systs);
+    fast_splines = getFastSplines(splines_copies, spline_options);
+    fast_splines.setBinEdges(getSplineBinning(splines_file));
+    fast_splines.setSourceHash(splinesHash(splines_file));
+    fast_splines.setSystNames(getSystNames(n_spline_systs));
+    checkSplines(fast_splines, splines_copies);
+    fast_splines.save(spline_bank_file);
+  }
+  auto spline_binning = fast_splines.binEdges();
+  // getSplineBin relies on this to send events outside the binning to the
+  // outside bin of the bank
+  if (spline_binning.size() != static_cast<size_t>(fast_splines.nSplineBins()) + 1) {
+    throw std::runtime_error(std::string(splines_file) + ": the spline binning has " +
+                             std::to_string(static_cast<int>(spline_binning.size()) - 1) + " bins, the splines " +
+                             std::to_string(fast_splines.nSplineBins()));
+  }
+  auto end_splines = std::chrono::high_resolution_clock::now();
+  std::cout << "Spline setup: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(end_splines - start_splines).count()
+            << " ms" << std::endl;
 
-  checkSplines(fast_splines, splines_copies);
+  auto spline_state = fast_splines.createState();
+  fast_splines.printSummary();
+  std::cout << "Spline kernel: " << SplineKernels::kernelName(fast_splines.kernel()) << std::endl;
 
   // number of times to loop over the graph with different parameters,
   // equivalent to number of faked MCMC steps
   int n_trials = 100;
-  auto random_params = getRandomParams(n_trials, n_spline_systs);
+  auto random_params = getRandomParams(n_trials, n_spline_systs, n_changed_spline_params);
+
+  // the spline evaluation alone, re-evaluating every spline each step against
+  // only those of the parameters that changed
+  {
+    auto all_state = fast_splines.createState(), changed_state = fast_splines.createState();
+    auto start_all = std::chrono::high_resolution_clock::now();
+    for (const auto &params : random_params) fast_splines.evaluateAll(params.spline_params, all_state);
+    auto start_changed = std::chrono::high_resolution_clock::now();
+    for (const auto &params : random_params) fast_splines.evaluateChanged(params.spline_params, changed_state);
+    auto end_changed = std::chrono::high_resolution_clock::now();
+    std::cout << "Spline evaluation per trial (" << n_changed_spline_params << " of " << n_spline_systs
+              << " parameters changed): "
+              << std::chrono::duration_cast<std::chrono::microseconds>(start_changed - start_all).count() /
+                     static_cast<double>(n_trials)
+              << " us all, "
+              << std::chrono::duration_cast<std::chrono::microseconds>(end_changed - start_changed).count() /
+                     static_cast<double>(n_trials)
+              << " us changed only" << std::endl;
+  }
+
+  // cuts that do not depend on any fit parameter, applied once at load
+  std::vector<StaticCut> static_cuts = {
+      static_cut(Samples::parseCut("Enu_true", ">", "0")),
+      static_cut(Samples::parseCut("Enu_true", "<", "4")),
+  };
 
   // Warm up the data for both RDataFrame and standalone RNTuple+loop over
   // vectors
 
-  auto df = create_rdf(dataset_name, dataset_file);
+  auto df = create_rdf(dataset_name, dataset_file, static_cuts);
   df.Count().GetValue(); // Just to trigger the graph
 
-  auto rntuple_data = create_rntuple_data(dataset_name, dataset_file);
-  auto spline_bins = getSplineBins(rntuple_data, spline_binning);
+  ThreadPool pool;
+
+  // the prepared events are snapshotted on the first run and mapped straight
+  // back in on later runs, until any of their inputs change
+  auto start_load = std::chrono::high_resolution_clock::now();
+  const auto event_store_hash =
+      eventStoreHash(dataset_name, dataset_file, splines_file, spline_binning, static_cuts);
+  RNTupleData rntuple_data;
+  std::vector<int> spline_bins;
+  if (!loadEventStore(event_store_file, event_store_hash, rntuple_data, spline_bins)) {
+    rntuple_data = create_rntuple_data(dataset_name, dataset_file, static_cuts, pool);
+    spline_bins = getSplineBins(rntuple_data, spline_binning);
+    saveEventStore(event_store_file, event_store_hash, rntuple_data, spline_bins);
+  }
+  auto end_load = std::chrono::high_resolution_clock::now();
+  std::cout << "Event store setup (" << rntuple_data.Enu_true.size() << " events): "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(end_load - start_load).count() << " ms"
+            << std::endl;
+
+  std::vector<double> bins = {0.,   0.5, 1.,   1.25, 1.5,  1.75, 2., 2.25, 2.5,
+                              2.75, 3.,  3.25, 3.5,  3.75, 4.,   5., 6.,   10.};
+  FastHistogram1D h_ELep{"hELep", "ELep;ELep [GeV];Events", bins};
 
   auto start_rntuple_fast = std::chrono::high_resolution_clock::now();
 
   std::cout << "Running vectors" << std::endl;
   for (const auto &params : random_params) {
-    run_vectors_fast(rntuple_data, params, fast_splines, spline_bins);
+    run_vectors_fast(rntuple_data, params, fast_splines, spline_state, spline_bins, h_ELep);
   }
 
   auto end_rntuple_fast = std::chrono::high_resolution_clock::now();
@@ -340,10 +1092,200 @@ int main() {
 
   // -------
 
+  std::vector<FastHistogram1D> thread_hists(pool.nThreads(), h_ELep);
+
+  auto start_rntuple_parallel = std::chrono::high_resolution_clock::now();
+
+  std::cout << "Running vectors on " << pool.nThreads() << " threads" << std::endl;
+  for (const auto &params : random_params) {
+    run_vectors_parallel(rntuple_data, params, fast_splines, spline_state, spline_bins, pool, thread_hists, h_ELep);
+  }
+
+  auto end_rntuple_parallel = std::chrono::high_resolution_clock::now();
+  auto duration_rntuple_parallel = std::chrono::duration_cast<std::chrono::milliseconds>(
+      end_rntuple_parallel - start_rntuple_parallel);
+  std::cout << "Total time (RNTuple - Parallel): " << duration_rntuple_parallel.count() << " ms"
+            << std::endl;
+  std::cout << "Average time per trial (RNTuple - Parallel): "
+            << duration_rntuple_parallel.count() / static_cast<double>(n_trials) << " ms"
+            << std::endl;
+
+  // -------
+
+  // the float columns in 16 bits: Enu_true in fixed point over its range after
+  // the static cuts, ELep in half and Q2 in bfloat16 precision
+  CompactData compact_data{Compact::Column(rntuple_data.Enu_true, {Compact::Format::Fixed16, 0, 4}),
+                           Compact::Column(rntuple_data.ELep, {Compact::Format::Float16}),
+                           Compact::Column(rntuple_data.Q2, {Compact::Format::BFloat16})};
+  const auto compact_kernel = Compact::bestKernel();
+  report_compact(compact_data, rntuple_data, random_params.back(), fast_splines, spline_state, spline_bins, h_ELep,
+                 compact_kernel);
+
+  auto start_rntuple_compact = std::chrono::high_resolution_clock::now();
+
+  std::cout << "Running vectors on " << pool.nThreads() << " threads with compact columns" << std::endl;
+  for (const auto &params : random_params) {
+    run_vectors_compact(compact_data, rntuple_data, params, fast_splines, spline_state, spline_bins, pool,
+                        thread_hists, h_ELep, compact_kernel);
+  }
+
+  auto end_rntuple_compact = std::chrono::high_resolution_clock::now();
+  auto duration_rntuple_compact = std::chrono::duration_cast<std::chrono::milliseconds>(
+      end_rntuple_compact - start_rntuple_compact);
+  std::cout << "Total time (RNTuple - Compact): " << duration_rntuple_compact.count() << " ms"
+            << std::endl;
+  std::cout << "Average time per trial (RNTuple - Compact): "
+            << duration_rntuple_compact.count() / static_cast<double>(n_trials) << " ms"
+            << std::endl;
+
+  // -------
+
+  // the pool pins the calling thread while it exists, keep it scoped so that
+  // threads started later (e.g. by ROOT) are not pinned along
+  {
+    // one pool thread per CPU, grouped by NUMA node
+    auto numa_nodes = Numa::topology();
+    std::vector<int> numa_thread_cpus, numa_thread_node;
+    for (size_t node = 0; node < numa_nodes.size(); ++node) {
+      for (int cpu : numa_nodes[node].cpus) {
+        numa_thread_cpus.push_back(cpu);
+        numa_thread_node.push_back(node);
+      }
+    }
+    ThreadPool numa_pool(numa_thread_cpus);
+    std::vector<FastHistogram1D> numa_thread_hists(numa_pool.nThreads(), h_ELep);
+
+    // set to true to compare sharded placement with single-node and interleaved
+    // placement of the events
+    bool numa_benchmark = false;
+    std::vector<EventPlacement> placements = {EventPlacement::Sharded};
+    if (numa_benchmark) {
+      placements.push_back(EventPlacement::SingleNode);
+      placements.push_back(EventPlacement::Interleaved);
+    }
+
+    for (auto placement : placements) {
+      auto shards = make_event_shards(rntuple_data, spline_bins, numa_nodes, numa_thread_node, numa_pool, placement);
+
+      auto start_rntuple_numa = std::chrono::high_resolution_clock::now();
+
+      std::cout << "Running vectors on " << numa_nodes.size() << " NUMA node(s), " << placementName(placement)
+                << std::endl;
+      for (const auto &params : random_params) {
+        run_vectors_numa(shards, params, fast_splines, spline_state, numa_thread_node, numa_pool, numa_thread_hists,
+                         h_ELep);
+      }
+
+      auto end_rntuple_numa = std::chrono::high_resolution_clock::now();
+      auto duration_rntuple_numa = std::chrono::duration_cast<std::chrono::milliseconds>(
+          end_rntuple_numa - start_rntuple_numa);
+      std::cout << "Total time (RNTuple - NUMA " << placementName(placement) << "): " << duration_rntuple_numa.count()
+                << " ms" << std::endl;
+      std::cout << "Average time per trial (RNTuple - NUMA " << placementName(placement) << "): "
+                << duration_rntuple_numa.count() / static_cast<double>(n_trials) << " ms" << std::endl;
+    }
+  }
+
+  // -------
+
+  StepGraph step_graph;
+  Params graph_params;
+  build_step_graph(step_graph, rntuple_data, &graph_params, fast_splines, spline_state, spline_bins, h_ELep);
+
+  auto start_rntuple_graph = std::chrono::high_resolution_clock::now();
+
+  std::cout << "Running vectors as a task graph of " << step_graph.graph.nTasks() << " tasks" << std::endl;
+  for (const auto &params : random_params) {
+    graph_params = params;
+    step_graph.graph.run(pool);
+  }
+
+  auto end_rntuple_graph = std::chrono::high_resolution_clock::now();
+  auto duration_rntuple_graph = std::chrono::duration_cast<std::chrono::milliseconds>(
+      end_rntuple_graph - start_rntuple_graph);
+  std::cout << "Total time (RNTuple - Task graph): " << duration_rntuple_graph.count() << " ms"
+            << std::endl;
+  std::cout << "Average time per trial (RNTuple - Task graph): "
+            << duration_rntuple_graph.count() / static_cast<double>(n_trials) << " ms"
+            << std::endl;
+
+  // -------
+
+  // memory for the two chunk buffers of the streaming mode, small here so that
+  // the one sample is split into several chunks
+  size_t stream_memory_budget = 256 << 10;
+  std::vector<std::pair<std::string, std::unique_ptr<EventStream>>> streams;
+  streams.emplace_back("snapshot", stream_event_store(event_store_file, event_store_hash, stream_memory_budget));
+  streams.emplace_back("RNTuple", stream_rntuple(dataset_name, dataset_file, static_cuts, spline_binning,
+                                                 stream_memory_budget));
+
+  for (auto &stream : streams) {
+    if (!stream.second) continue;
+
+    auto start_rntuple_stream = std::chrono::high_resolution_clock::now();
+
+    std::cout << "Running vectors streamed from the " << stream.first << " in " << stream.second->nChunks()
+              << " chunk(s)" << std::endl;
+    for (const auto &params : random_params) {
+      run_vectors_streaming(*stream.second, params, fast_splines, spline_state, pool, thread_hists, h_ELep);
+    }
+
+    auto end_rntuple_stream = std::chrono::high_resolution_clock::now();
+    auto duration_rntuple_stream = std::chrono::duration_cast<std::chrono::milliseconds>(
+        end_rntuple_stream - start_rntuple_stream);
+    std::cout << "Total time (RNTuple - Streamed from " << stream.first << "): " << duration_rntuple_stream.count()
+              << " ms" << std::endl;
+    std::cout << "Average time per trial (RNTuple - Streamed from " << stream.first << "): "
+              << duration_rntuple_stream.count() / static_cast<double>(n_trials) << " ms" << std::endl;
+  }
+  streams.clear();
+
+  // -------
+
+  // all samples of the manifest, loaded concurrently into one store
+  auto samples = Samples::readManifest(manifest_file);
+  for (const auto &sample : samples) {
+    if (sample.splines != splines_file) {
+      throw std::runtime_error("Sample " + sample.name + " uses " + sample.splines +
+                               ", but all samples share the spline bank of " + splines_file);
+    }
+  }
+
+  auto start_samples_load = std::chrono::high_resolution_clock::now();
+  auto sample_store = load_samples(samples, spline_binning, pool);
+  auto end_samples_load = std::chrono::high_resolution_clock::now();
+  std::cout << "Loading " << samples.size() << " sample(s): "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(end_samples_load - start_samples_load).count()
+            << " ms" << std::endl;
+
+  std::vector<FastHistogram1D> sample_hists;
+  for (const auto &sample : samples) {
+    sample_hists.emplace_back("hELep_" + sample.name, sample.name + ";ELep [GeV];Events", bins);
+  }
+  std::vector<std::vector<FastHistogram1D>> sample_thread_hists(pool.nThreads(), sample_hists);
+
+  auto start_rntuple_samples = std::chrono::high_resolution_clock::now();
+
+  std::cout << "Running vectors over " << samples.size() << " sample(s)" << std::endl;
+  for (const auto &params : random_params) {
+    run_vectors_samples(sample_store, params, fast_splines, spline_state, pool, sample_thread_hists, sample_hists);
+  }
+
+  auto end_rntuple_samples = std::chrono::high_resolution_clock::now();
+  auto duration_rntuple_samples = std::chrono::duration_cast<std::chrono::milliseconds>(
+      end_rntuple_samples - start_rntuple_samples);
+  std::cout << "Total time (RNTuple - Samples): " << duration_rntuple_samples.count() << " ms"
+            << std::endl;
+  std::cout << "Average time per trial (RNTuple - Samples): "
+            << duration_rntuple_samples.count() / static_cast<double>(n_trials) << " ms"
+            << std::endl;
+
+  // -------
+
   Params* current_params = &random_params[0];
 
-  auto df_rw = get_rw_df(df, current_params, fast_splines, spline_binning);
-  run_rdf_rw_fast(df_rw, fast_splines, current_params);
+  auto df_rw = get_rw_df(df, current_params, &spline_state, spline_binning);
+  run_rdf_rw_fast(df_rw, fast_splines, spline_state, current_params);
 
   auto start_rw_df_fast = std::chrono::high_resolution_clock::now();
 
@@ -351,8 +1293,8 @@ int main() {
   for (const auto &params : random_params) {
     *current_params = params;
     //run_rdf_fast(df, params, fast_splines, spline_binning);
-    //printSplineValues(fast_splines);
-    run_rdf_rw_fast(df_rw, fast_splines, current_params);
+    //printSplineValues(fast_splines, spline_state);
+    run_rdf_rw_fast(df_rw, fast_splines, spline_state, current_params);
   }
 
   auto end_rw_df_fast = std::chrono::high_resolution_clock::now();
@@ -0,0 +1,95 @@
+// Measures the fork/join overhead of ThreadPool::run, i.e. the time a step
+// loses to starting and finishing a parallel region, against the number of
+// threads. Every region runs an empty task, so all of the time is overhead.
+//
+// Modes compared:
+// - spin:   pinned workers spinning before they park (the default)
+// - park:   workers park on a condition variable straight away
+// - spawn:  new std::threads for every region, as a baseline
+//
+// Does not need ROOT:
+// g++ -O3 -pthread -o threadpool_benchmark.out threadpool_benchmark.cpp
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Timing {
+  double median;
+  double p99;
+};
+
+Timing summarise(std::vector<double> &us)
+{
+  std::sort(us.begin(), us.end());
+  return {us[us.size() / 2], us[std::min(us.size() - 1, us.size() * 99 / 100)]};
+}
+
+Timing benchmark_pool(ThreadPool &pool, int n_regions)
+{
+  std::vector<int> touched(pool.nThreads() * 16, 0);
+  auto task = [&touched](int thread) { touched[thread * 16]++; };
+
+  // warm up, so the workers are running and (if they do) spinning
+  for (int i = 0; i < 100; ++i) pool.run(task);
+
+  std::vector<double> us;
+  us.reserve(n_regions);
+  for (int i = 0; i < n_regions; ++i) {
+    auto start = Clock::now();
+    pool.run(task);
+    us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+  }
+  return summarise(us);
+}
+
+Timing benchmark_spawn(int n_threads, int n_regions)
+{
+  std::vector<int> touched(n_threads * 16, 0);
+  std::vector<double> us;
+  us.reserve(n_regions);
+  for (int i = 0; i < n_regions; ++i) {
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < n_threads; ++thread) {
+      threads.emplace_back([&touched, thread] { touched[thread * 16]++; });
+    }
+    touched[0]++;
+    for (auto &t : threads) t.join();
+    us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+  }
+  return summarise(us);
+}
+
+int main()
+{
+  const int n_regions = 2000;
+  std::printf("%u hardware threads, %d fork/joins per point, times in us\n",
+              std::thread::hardware_concurrency(), n_regions);
+  std::printf("%8s %14s %14s %14s %14s %14s %14s\n", "threads", "spin median", "spin p99", "park median",
+              "park p99", "spawn median", "spawn p99");
+
+  for (int n_threads : {1, 2, 4, 8, 16, 32, 64}) {
+    Timing spin, park;
+    {
+      ThreadPool pool(n_threads, true);
+      spin = benchmark_pool(pool, n_regions);
+    }
+    {
+      ThreadPool pool(n_threads, false, std::chrono::microseconds(0));
+      park = benchmark_pool(pool, n_regions);
+    }
+    // spawning is slow, fewer repetitions are plenty
+    Timing spawn = benchmark_spawn(n_threads, n_regions / 10);
+
+    std::printf("%8d %14.2f %14.2f %14.2f %14.2f %14.2f %14.2f\n", n_threads, spin.median, spin.p99, park.median,
+                park.p99, spawn.median, spawn.p99);
+  }
+  return 0;
+}